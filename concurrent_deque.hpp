@@ -0,0 +1,251 @@
+#ifndef SJTU_CONCURRENT_DEQUE_HPP
+#define SJTU_CONCURRENT_DEQUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sjtu {
+
+/**
+ * @brief   A thread-safe queue shared by multiple producers pushing at the back and multiple consumers popping from
+ *          the front
+ *
+ * The two ends are guarded by two independent locks, so producers never contend with consumers. Elements are stored
+ * in a linked list of buckets with fixed capacity, like the buckets of @code{deque}, where producers fill the last
+ * bucket and consumers drain the first one. The only synchronization between the two ends is publishing the number
+ * of elements in a bucket and the link to the next bucket, and a bucket is freed by the consumers once it is drained
+ * and linked to its next, after which the producers never touch it.
+ *
+ * @code{push_back_n} and @code{try_pop_front_n} take the lock once and publish once per bucket, amortizing the
+ * synchronization across many elements.
+ *
+ * @tparam T                The type of elements. MUST have move constructor.
+ * @tparam BucketCapacity   The number of elements in each bucket
+ */
+template <typename T, size_t BucketCapacity = 256>
+class concurrent_deque {
+    static_assert(BucketCapacity > 0, "BucketCapacity must be positive");
+
+  private:
+    /**
+     * @brief   A bucket storing elements in @code{[0, count)}, where @code{count} is written by producers only
+     */
+    struct bucket {
+        std::atomic<size_t> count;
+        std::atomic<bucket *> next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type slots[BucketCapacity];
+
+        bucket() : count(0), next(nullptr) {}
+
+        T *data() { return reinterpret_cast<T *>(slots); }
+    };
+
+    /**
+     * @brief   The state of the front, which is accessed by consumers holding @code{mutex} only
+     */
+    struct alignas(64) front_end {
+        std::mutex mutex;
+        bucket *cur;
+        size_t start;
+        std::atomic<size_t> popped;
+    } __front;
+
+    /**
+     * @brief   The state of the back, which is accessed by producers holding @code{mutex} only
+     */
+    struct alignas(64) back_end {
+        std::mutex mutex;
+        bucket *cur;
+        std::atomic<size_t> pushed;
+    } __back;
+
+    /**
+     * @brief   Make room in the last bucket for pushing, linking a new bucket if it is full
+     *
+     * @return  The number of elements already in the last bucket
+     */
+    size_t __back_room() {
+        size_t count = __back.cur->count.load(std::memory_order_relaxed);
+        if (count < BucketCapacity) return count;
+        auto new_bucket = new bucket;
+        __back.cur->next.store(new_bucket, std::memory_order_release);
+        __back.cur = new_bucket;
+        return 0;
+    }
+
+    /**
+     * @brief   Find the first bucket with elements available for popping, freeing drained buckets
+     *
+     * @return  The number of elements published in the first bucket, which equals @code{__front.start} if the
+     *          container is empty
+     */
+    size_t __front_available() {
+        while (true) {
+            size_t count = __front.cur->count.load(std::memory_order_acquire);
+            if (__front.start < count || count < BucketCapacity) return count;
+            bucket *next = __front.cur->next.load(std::memory_order_acquire);
+            if (!next) return count;
+            delete __front.cur;
+            __front.cur = next;
+            __front.start = 0;
+        }
+    }
+
+  public:
+    /**
+     * @brief   Construct an empty container
+     */
+    concurrent_deque() {
+        __front.cur = __back.cur = new bucket;
+        __front.start = 0;
+        __front.popped.store(0, std::memory_order_relaxed);
+        __back.pushed.store(0, std::memory_order_relaxed);
+    }
+
+    concurrent_deque(const concurrent_deque &) = delete;
+    concurrent_deque &operator=(const concurrent_deque &) = delete;
+
+    /**
+     * @brief   Destroy the container with remaining elements, which MUST NOT be accessed by any other thread
+     */
+    ~concurrent_deque() {
+        bucket *cur = __front.cur;
+        size_t start = __front.start;
+        while (cur) {
+            size_t count = cur->count.load(std::memory_order_relaxed);
+            for (size_t i = start; i < count; i++)
+                cur->data()[i].~T();
+            bucket *next = cur->next.load(std::memory_order_relaxed);
+            delete cur;
+            cur = next;
+            start = 0;
+        }
+    }
+
+    /**
+     * @brief   Add an element at the back
+     */
+    void push_back(const T &value) {
+        std::lock_guard<std::mutex> lock(__back.mutex);
+        size_t count = __back_room();
+        new (__back.cur->data() + count) T(value);
+        __back.cur->count.store(count + 1, std::memory_order_release);
+        __back.pushed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief   Add an element at the back by moving
+     */
+    void push_back(T &&value) {
+        std::lock_guard<std::mutex> lock(__back.mutex);
+        size_t count = __back_room();
+        new (__back.cur->data() + count) T(std::move(value));
+        __back.cur->count.store(count + 1, std::memory_order_release);
+        __back.pushed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief   Add @code{n} elements starting from @code{first} at the back in order, which will not interleave with
+     *          elements pushed by other producers
+     *
+     * If constructing an element throws, the elements before it remain pushed.
+     */
+    template <typename InputIterator>
+    void push_back_n(InputIterator first, size_t n) {
+        std::lock_guard<std::mutex> lock(__back.mutex);
+        for (size_t remaining = n; remaining > 0;) {
+            size_t count = __back_room();
+            size_t batch = BucketCapacity - count < remaining ? BucketCapacity - count : remaining;
+            T *data = __back.cur->data();
+            size_t i = 0;
+            try {
+                for (; i < batch; i++, ++first)
+                    new (data + count + i) T(*first);
+            } catch (...) {
+                __back.cur->count.store(count + i, std::memory_order_release);
+                __back.pushed.fetch_add(i, std::memory_order_relaxed);
+                throw;
+            }
+            __back.cur->count.store(count + batch, std::memory_order_release);
+            __back.pushed.fetch_add(batch, std::memory_order_relaxed);
+            remaining -= batch;
+        }
+    }
+
+    /**
+     * @brief   Remove the first element by moving it into @code{value}
+     *
+     * If the assignment throws, the element is left at the front.
+     *
+     * @return  Whether an element is popped, which fails only if the container is empty
+     */
+    bool try_pop_front(T &value) {
+        std::lock_guard<std::mutex> lock(__front.mutex);
+        size_t count = __front_available();
+        if (__front.start == count) return false;
+        T *element = __front.cur->data() + __front.start;
+        value = std::move(*element);
+        element->~T();
+        __front.start++;
+        __front.popped.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief   Remove at most @code{n} elements from the front, moving them to @code{out} in order
+     *
+     * If an assignment throws, the elements moved before it remain popped and the rest are left at the front.
+     *
+     * @return  The number of elements popped, which is less than @code{n} only if the container becomes empty
+     */
+    template <typename OutputIterator>
+    size_t try_pop_front_n(OutputIterator out, size_t n) {
+        std::lock_guard<std::mutex> lock(__front.mutex);
+        size_t popped = 0;
+        while (popped < n) {
+            size_t count = __front_available();
+            if (__front.start == count) break;
+            size_t batch = count - __front.start < n - popped ? count - __front.start : n - popped;
+            T *data = __front.cur->data() + __front.start;
+            size_t i = 0;
+            try {
+                for (; i < batch; i++, ++out) {
+                    *out = std::move(data[i]);
+                    data[i].~T();
+                }
+            } catch (...) {
+                __front.start += i;
+                __front.popped.fetch_add(popped + i, std::memory_order_relaxed);
+                throw;
+            }
+            __front.start += batch;
+            popped += batch;
+        }
+        __front.popped.fetch_add(popped, std::memory_order_relaxed);
+        return popped;
+    }
+
+    /**
+     * @return  The number of elements, which is only a hint when other threads are accessing the container
+     */
+    size_t size() const {
+        size_t popped = __front.popped.load(std::memory_order_relaxed);
+        size_t pushed = __back.pushed.load(std::memory_order_relaxed);
+        return pushed > popped ? pushed - popped : 0;
+    }
+
+    /**
+     * @return  Whether the container is empty, which is only a hint when other threads are accessing the container
+     */
+    bool empty() const {
+        return size() == 0;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "../concurrent_deque.hpp"
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int failed = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("Failed: %s (line %d)\n", #condition, __LINE__); \
+        failed++; \
+    } \
+} while (0)
+
+void test_single_thread() {
+    sjtu::concurrent_deque<std::string, 8> deq;
+    std::string value;
+    CHECK(!deq.try_pop_front(value) && deq.empty());
+    for (int i = 0; i < 100; i++)
+        deq.push_back(std::to_string(i));
+    std::vector<std::string> batch(30, "x");
+    deq.push_back_n(batch.begin(), batch.size());
+    CHECK(deq.size() == 130);
+    CHECK(deq.try_pop_front(value) && value == "0");
+    std::vector<std::string> out(50);
+    CHECK(deq.try_pop_front_n(out.begin(), 50) == 50);
+    bool ok = true;
+    for (int i = 0; i < 50; i++)
+        ok = ok && out[i] == std::to_string(i + 1);
+    CHECK(ok);
+    CHECK(deq.try_pop_front_n(out.begin(), 50) == 50);
+    CHECK(out[48] == "99" && out[49] == "x");
+    CHECK(deq.size() == 29);
+    // the remaining elements are destroyed with the container
+}
+
+struct fragile {
+    static int alive, countdown;
+    int value;
+
+    static void tick() {
+        if (countdown > 0 && --countdown == 0) throw 0;
+    }
+
+    fragile(int value = 0) : value(value) { alive++; }
+    fragile(const fragile &other) : value(other.value) { tick(); alive++; }
+    fragile(fragile &&other) : value(other.value) { alive++; }
+    fragile &operator=(const fragile &other) { value = other.value; return *this; }
+    fragile &operator=(fragile &&other) { tick(); value = other.value; return *this; }
+    ~fragile() { alive--; }
+};
+int fragile::alive = 0, fragile::countdown = 0;
+
+void test_exceptions() {
+    {
+        sjtu::concurrent_deque<fragile, 4> deq;
+        std::vector<fragile> batch;
+        for (int i = 0; i < 10; i++)
+            batch.emplace_back(i);
+        // the copy of the 7th element throws, after a full bucket and a half-full one are published
+        fragile::countdown = 7;
+        bool thrown = false;
+        try {
+            deq.push_back_n(batch.begin(), batch.size());
+        } catch (int) {
+            thrown = true;
+        }
+        CHECK(thrown && deq.size() == 6 && fragile::alive == 16);
+
+        fragile value(-1);
+        fragile::countdown = 1;
+        thrown = false;
+        try {
+            deq.try_pop_front(value);
+        } catch (int) {
+            thrown = true;
+        }
+        CHECK(thrown && deq.size() == 6 && fragile::alive == 17);
+        CHECK(deq.try_pop_front(value) && value.value == 0);
+
+        std::vector<fragile> out(5);
+        fragile::countdown = 3;
+        thrown = false;
+        try {
+            deq.try_pop_front_n(out.begin(), out.size());
+        } catch (int) {
+            thrown = true;
+        }
+        CHECK(thrown && deq.size() == 3 && out[1].value == 2);
+        CHECK(deq.try_pop_front_n(out.begin(), out.size()) == 3 && out[0].value == 3 && out[2].value == 5);
+        CHECK(deq.empty() && fragile::alive == 16);
+    }
+    CHECK(fragile::alive == 0);
+}
+
+void test_stress() {
+    const int PRODUCERS = 3, CONSUMERS = 3, N = 300000;
+    sjtu::concurrent_deque<int> deq;
+    std::vector<std::atomic<int>> taken(PRODUCERS * N);
+    for (auto &t : taken) t.store(0);
+    std::atomic<int> finished(0);
+    std::atomic<bool> ordered(true);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < PRODUCERS; p++)
+        threads.emplace_back([&, p] {
+            std::vector<int> batch;
+            for (int i = 0; i < N; i++) {
+                if (p == 0 || i % 64 >= 32) {
+                    deq.push_back(p * N + i);
+                } else {
+                    batch.push_back(p * N + i);
+                    if (batch.size() == 32) {
+                        deq.push_back_n(batch.begin(), batch.size());
+                        batch.clear();
+                    }
+                }
+            }
+            finished++;
+        });
+    for (int c = 0; c < CONSUMERS; c++)
+        threads.emplace_back([&, c] {
+            std::vector<int> last(PRODUCERS, -1), out(100);
+            auto take = [&](int value) {
+                // elements from the same producer are popped in order
+                if (value % N <= last[value / N]) ordered = false;
+                last[value / N] = value % N;
+                taken[value]++;
+            };
+            while (finished.load() < PRODUCERS || !deq.empty()) {
+                if (c == 0) {
+                    int value;
+                    if (deq.try_pop_front(value)) take(value);
+                } else {
+                    size_t count = deq.try_pop_front_n(out.begin(), 1 + c * 37);
+                    for (size_t i = 0; i < count; i++)
+                        take(out[i]);
+                }
+            }
+        });
+    for (auto &thread : threads)
+        thread.join();
+    bool ok = true;
+    for (int i = 0; i < PRODUCERS * N; i++)
+        ok = ok && taken[i].load() == 1;
+    CHECK(ok && ordered.load() && deq.empty());
+}
+
+int main() {
+    test_single_thread();
+    test_exceptions();
+    test_stress();
+    if (failed == 0) puts("All tests passed.");
+    return failed != 0;
+}
@@ -2,340 +2,2564 @@
 #define SJTU_DEQUE_HPP
 
 #include "exceptions.hpp"
+#include "utility.hpp"
 
+#include <atomic>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifdef SJTU_DEQUE_STATS
+#define SJTU_DEQUE_COUNT(counter) (++__stats_##counter)
+#else
+#define SJTU_DEQUE_COUNT(counter) ((void)0)
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SJTU_DEQUE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace sjtu {
 
+/**
+ * @brief   The default sizing policy of buckets in deque, adapting the sizes of buckets to about sqrt of the size of
+ *          the container, so that inserting or removing in the middle takes O(sqrt n) time
+ *
+ * A sizing policy provides the following thresholds, each of which is a function of the size of the container.
+ *
+ * If a bucket contains more than @code{split(n)} elements after inserting, it will be split into two buckets with
+ * approximately same size.
+ *
+ * If a bucket contains more than @code{fresh(n)} elements before pushing at either side, a new bucket will be
+ * constructed to store the required element.
+ *
+ * If a bucket and its previous(or following) container contain less than @code{merge(n)} after removing, they will
+ * be merged into a single bucket.
+ *
+ * A bucket newly constructed has at least @code{capacity(n)} slots, and buckets filled in bulk get @code{fill(n)}
+ * elements each.
+ */
+struct sqrt_bucket_policy {
+    static constexpr double MIN_FOR_SPLIT = 9.9;
+    static constexpr double CONSTANT_FOR_SPLIT = 2.89;
+    static constexpr double CONSTANT_FOR_NEW = 1.98;
+    static constexpr double CONSTANT_FOR_MERGE = 0.48;
+
+    static constexpr double max(double a, double b) { return a > b ? a : b; }
+    static double split(size_t n) {
+        return max(MIN_FOR_SPLIT, CONSTANT_FOR_SPLIT * std::sqrt(n));
+    }
+    static double fresh(size_t n) {
+        return max(MIN_FOR_SPLIT, CONSTANT_FOR_NEW * std::sqrt(n));
+    }
+    static double merge(size_t n) {
+        return CONSTANT_FOR_MERGE * std::sqrt(n);
+    }
+    static size_t capacity(size_t n) {
+        return static_cast<size_t>(fresh(n)) + 2;
+    }
+    static size_t fill(size_t n) {
+        return static_cast<size_t>(fresh(n)) + 1;
+    }
+};
+
+/**
+ * @brief   A sizing policy of buckets in deque with a fixed capacity resolved at compile time
+ *
+ * Pushing at either side only checks whether the bucket at that side is full, and no floating point arithmetic is
+ * involved. It suits containers used as queues or stacks, since inserting or removing in the middle takes
+ * O(n / Capacity) time.
+ *
+ * @tparam Capacity The capacity of every bucket. MUST be a power of two no less than 4.
+ */
+template <size_t Capacity>
+struct fixed_bucket_policy {
+    static_assert(Capacity >= 4 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two no less than 4");
+
+    static constexpr size_t split(size_t) { return Capacity; }
+    static constexpr size_t fresh(size_t) { return Capacity; }
+    static constexpr size_t merge(size_t) { return Capacity >> 1; }
+    static constexpr size_t capacity(size_t) { return Capacity; }
+    static constexpr size_t fill(size_t) { return Capacity; }
+};
+
+/**
+ * @brief   The memory usage and layout of a deque, reported by @code{deque::stats()}
+ *
+ * The numbers of splits and merges are counted only if @code{SJTU_DEQUE_STATS} is defined before including this
+ * header, and they are always zero otherwise, so that counting costs nothing unless enabled.
+ */
+struct deque_stats {
+    static constexpr size_t HISTOGRAM_BINS = 32;
+
+    size_t size;                        // the number of elements
+    size_t bucket_count;                // the number of buckets, excluding sentinels
+    size_t min_occupancy;               // the least number of elements in a bucket
+    size_t max_occupancy;               // the most number of elements in a bucket
+    double avg_occupancy;               // the average number of elements in a bucket
+    size_t slots;                       // the total capacity of buckets
+    size_t histogram[HISTOGRAM_BINS];   // histogram[i] is the number of buckets with [2^i, 2^(i+1)) elements
+    size_t splits;                      // the number of buckets split
+    size_t merges;                      // the number of buckets merged
+    size_t bytes;                       // the total bytes allocated, including storages shared with snapshots
+    size_t pool_bytes;                  // the bytes kept in the pool of buckets, which are included in bytes
+    size_t spilled_buckets;             // the number of buckets whose elements are in the spill file
+    size_t spills;                      // the number of buckets written to the spill file
+    size_t faults;                      // the number of buckets read back from the spill file
+    size_t prefetches;                  // the number of buckets advised to be read ahead
+};
+
+struct __deque_algorithm;
+
+/**
+ * @brief   The category of an iterator, where an iterator declaring no category is regarded as an input iterator
+ */
+template <typename Iterator, typename = void>
+struct __iterator_category {
+    using type = std::input_iterator_tag;
+};
+
+template <typename Iterator>
+struct __iterator_category<
+        Iterator,
+        typename std::conditional<true, void, typename std::iterator_traits<Iterator>::iterator_category>::type> {
+    using type = typename std::iterator_traits<Iterator>::iterator_category;
+};
+
 /**
  * @brief   A linear data structures supporting inserting and removing
  *
  * This container supports following operation in O(1) time: accessing, inserting before, or removing the first
  * element; accessing, inserting after, or removing the last element; find previous or following element.
- * This container also supports following operation in O(sqrt n) time: accessing with indices, inserting or
- * removing anywhere; find previous or following n element; calculating the distance between two elements.
+ * This container also supports following operation in O(log n) time: accessing with indices; find previous or
+ * following n element; calculating the distance between two elements. The last two take O(1) time unless an element
+ * has been inserted or removed in the middle since the last query. Inserting or removing anywhere takes O(sqrt n)
+ * time.
+ *
+ * This implementation uses "Unrolled linked list" as its internal structure, where each bucket stores its elements
+ * in a ring array, so that accessing inside a bucket is index arithmetic. A Fenwick tree over the sizes of buckets
+ * is used to locate the bucket of an index. The sentinel buckets are embedded in the container, so an empty
+ * container allocates nothing, and a bucket with @code{InlineCapacity} slots may be embedded as well, so that a
+ * container holding no more elements needs no allocation at all.
  *
- * This implementation uses "Unrolled linked list as its internal structure.
+ * The index, the cached offsets of buckets and spilled buckets are brought up to date lazily, even by const member
+ * functions, so unlike the standard containers, const member functions MUST NOT be called concurrently on the same
+ * container. Threads reading the same elements should each read their own @code{snapshot}.
  *
- * @tparam T    The type of elements stored in this container. MUST have copy constructor.
+ * @tparam T                The type of elements stored in this container. MUST have move constructor, and copying
+ *                          the container requires copy constructor.
+ * @tparam Policy           The sizing policy of buckets, see @code{sqrt_bucket_policy}
+ * @tparam InlineCapacity   The number of elements stored in the container itself. MUST be 0 or a power of two.
  */
-template <typename T>
+template <typename T, typename Policy = sqrt_bucket_policy, size_t InlineCapacity = 0>
 class deque {
+    static_assert((InlineCapacity & (InlineCapacity - 1)) == 0, "InlineCapacity must be 0 or a power of two");
+
   private:
     size_t __size;
 
   private:
     /**
-     * @brief   Several parameters for splitting and merging buckets
-     *
-     * If a bucket contains more than @code{SPLIT_PARA()} elements after inserting, it will be split into
-     * two buckets with approximately same size.
-     *
-     * If a bucket contains more than @code{NEW_PARA()} elements before pushing at either side, a new bucket
-     * will be constructed to store the required element.
-     *
-     * If a bucket and its previous(or following) container contain less than @code{MERGE_PARA()} after removing,
-     * they will be merged into a single bucket.
+     * @brief   Several parameters for splitting and merging buckets, given by @code{Policy}
      */
-    static constexpr double MIN_FOR_SPLIT = 9.9;
-    static constexpr double CONSTANT_FOR_SPLIT = 2.89;
-    static constexpr double CONSTANT_FOR_NEW = 1.98;
-    static constexpr double CONSTANT_FOR_MERGE = 0.48;
-
-    static constexpr double max(double a, double b) { return a > b ? a : b; }
-    double SPLIT_PARA() {
-        return max(MIN_FOR_SPLIT, CONSTANT_FOR_SPLIT * std::sqrt(__size));
+    auto SPLIT_PARA() -> decltype(Policy::split(0)) {
+        return Policy::split(__size);
     }
-    double NEW_PARA() {
-        return max(MIN_FOR_SPLIT, CONSTANT_FOR_NEW * std::sqrt(__size));
+    auto NEW_PARA() -> decltype(Policy::fresh(0)) {
+        return Policy::fresh(__size);
     }
-    double MERGE_PARA() {
-        return CONSTANT_FOR_MERGE * std::sqrt(__size);
+    auto MERGE_PARA() -> decltype(Policy::merge(0)) {
+        return Policy::merge(__size);
     }
 
   private:
     /**
-     * @brief   A unit in the container, which stores at most approximately sqrt(n) elements
+     * @brief   A file mapped into memory by @code{load_mapped}, which is unmapped when no block refers to it
      */
-    struct bucket;
+    struct mapping {
+        std::atomic<size_t> ref;
+        void *address;
+        size_t length;
+
+        mapping(void *address, size_t length) : ref(1), address(address), length(length) {}
+
+        static void __release(mapping *tar_mapping) {
+            if (tar_mapping->ref.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+#ifdef SJTU_DEQUE_MMAP
+            munmap(tar_mapping->address, tar_mapping->length);
+#endif
+            delete tar_mapping;
+        }
+    };
+
+    /**
+     * @brief   Move the position of @code{file} to @code{offset} from its beginning, which may be beyond 2 GiB
+     *          where @code{long} is 32 bits
+     *
+     * @return  false if the offset cannot be represented by the file API of the system, or the seek fails
+     */
+    static bool __seek_file(FILE *file, std::uint64_t offset) {
+#if defined(SJTU_DEQUE_MMAP)
+        if (offset > static_cast<std::uint64_t>(std::numeric_limits<off_t>::max())) return false;
+        return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#elif defined(_WIN32)
+        if (offset > static_cast<std::uint64_t>(std::numeric_limits<long long>::max())) return false;
+        return _fseeki64(file, static_cast<long long>(offset), SEEK_SET) == 0;
+#else
+        if (offset > static_cast<std::uint64_t>(std::numeric_limits<long>::max())) return false;
+        return fseek(file, static_cast<long>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    /**
+     * @brief   Find the length of @code{file} by seeking to its end, which may be beyond 2 GiB where @code{long} is
+     *          32 bits
+     *
+     * @return  false if the length cannot be found
+     */
+    static bool __file_length(FILE *file, std::uint64_t &length) {
+#if defined(SJTU_DEQUE_MMAP)
+        if (fseeko(file, 0, SEEK_END) != 0) return false;
+        off_t position = ftello(file);
+#elif defined(_WIN32)
+        if (_fseeki64(file, 0, SEEK_END) != 0) return false;
+        long long position = _ftelli64(file);
+#else
+        if (fseek(file, 0, SEEK_END) != 0) return false;
+        long position = ftell(file);
+#endif
+        if (position < 0) return false;
+        length = static_cast<std::uint64_t>(position);
+        return true;
+    }
+
+    /**
+     * @brief   A file holding the elements of spilled buckets, which is closed when no container or bucket refers
+     *          to it
+     *
+     * On POSIX systems the file is removed right after it is created, so that it never outlives the process and
+     * its path can be reused at once. Otherwise it is removed when closed.
+     *
+     * The file is divided into regions, each of which holds the elements of a bucket. Since capacities are powers
+     * of two, a freed region is kept in the list for its capacity, and reused by the next bucket of that capacity.
+     */
+    struct __spill_file {
+        struct region {
+            std::uint64_t offset;
+            region *next;
+        };
+
+        static constexpr size_t CAPACITY_CLASSES = 64;
+
+        size_t ref;
+        FILE *file;
+        char *path;
+        std::uint64_t end;
+        region *free_regions[CAPACITY_CLASSES];
+        size_t spills, faults, prefetches;
+        std::uint64_t prefetched;
+
+        /**
+         * @throw   runtime_error   if the file cannot be created
+         */
+        static __spill_file *__open(const char *path) {
+            FILE *file = fopen(path, "w+b");
+            if (file == nullptr) throw runtime_error();
+            auto result = new __spill_file();
+            result->ref = 1;
+            result->file = file;
+#ifdef SJTU_DEQUE_MMAP
+            unlink(path);
+#else
+            size_t length = 0;
+            while (path[length] != '\0') length++;
+            result->path = new char[length + 1];
+            for (size_t i = 0; i <= length; i++)
+                result->path[i] = path[i];
+#endif
+            result->prefetched = static_cast<std::uint64_t>(-1);
+            return result;
+        }
+
+        static void __release(__spill_file *tar_file) {
+            if (--tar_file->ref > 0) return;
+            fclose(tar_file->file);
+            if (tar_file->path != nullptr) remove(tar_file->path);
+            delete[] tar_file->path;
+            for (size_t i = 0; i < CAPACITY_CLASSES; i++) {
+                while (tar_file->free_regions[i] != nullptr) {
+                    region *cur = tar_file->free_regions[i];
+                    tar_file->free_regions[i] = cur->next;
+                    delete cur;
+                }
+            }
+            delete tar_file;
+        }
+
+        static size_t __class(size_t capacity) {
+            size_t result = 0;
+            while ((static_cast<size_t>(1) << result) < capacity) result++;
+            return result;
+        }
+
+        /**
+         * @return  The offset of a region for @code{capacity} elements
+         */
+        std::uint64_t __allocate(size_t capacity) {
+            region *&list = free_regions[__class(capacity)];
+            if (list == nullptr) {
+                std::uint64_t offset = end;
+                end += capacity * sizeof(T);
+                return offset;
+            }
+            region *cur = list;
+            list = cur->next;
+            std::uint64_t offset = cur->offset;
+            delete cur;
+            return offset;
+        }
+
+        void __free(std::uint64_t offset, size_t capacity) {
+            region *&list = free_regions[__class(capacity)];
+            list = new region{offset, list};
+        }
+
+        /**
+         * @brief   Advise the system to read @code{count} elements from @code{offset} ahead, which is only
+         *          supported on POSIX systems
+         */
+        void __prefetch(std::uint64_t offset, size_t count) {
+#ifdef SJTU_DEQUE_MMAP
+            fflush(file);
+            posix_fadvise(fileno(file), static_cast<off_t>(offset), static_cast<off_t>(count * sizeof(T)),
+                          POSIX_FADV_WILLNEED);
+#endif
+            prefetched = offset;
+            prefetches++;
+        }
+    };
 
     /**
-     * @brief   A unit in the bucket, which stores a single element
+     * @brief   The storage of a bucket, which may be shared by buckets of different containers
+     *
+     * A block is allocated together with its slots, which follow the header, unless it refers to elements in a
+     * mapped file. Buckets sharing a block have the same elements, and a bucket MUST copy the elements into a new
+     * block before modifying a shared or mapped one.
      */
-    struct node {
-        node *prev, *next;
-        T *value;
+    struct block {
+        std::atomic<size_t> ref;
+        T *data;
+        mapping *source;
+        bool embedded;
+
+        block() : ref(1), data(nullptr), source(nullptr), embedded(false) {}
+
+        static size_t __header_size() {
+            return (sizeof(block) + alignof(T) - 1) / alignof(T) * alignof(T);
+        }
 
-        node() : prev(nullptr), next(nullptr), value(nullptr) {}
+        static block *__create(size_t capacity) {
+            auto raw = static_cast<char *>(::operator new(__header_size() + capacity * sizeof(T)));
+            auto result = new(raw) block;
+            result->data = reinterpret_cast<T *>(raw + __header_size());
+            return result;
+        }
+
+        /**
+         * @return  A block referring to elements at @code{data} in a mapped file
+         */
+        static block *__map(mapping *source, T *data) {
+            auto result = __create(0);
+            result->data = data;
+            result->source = source;
+            source->ref.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
 
-        ~node() {
-            delete value;
+        /**
+         * @brief   Free a block, unless it is embedded in the container
+         */
+        static void __destroy(block *tar_block) {
+            if (tar_block->embedded) return;
+            if (tar_block->source) mapping::__release(tar_block->source);
+            tar_block->~block();
+            ::operator delete(tar_block);
         }
     };
 
-    struct bucket {
+    struct bucket;
+
+    /**
+     * @brief   The position of an element referred to by handles, which is the @code{index}-th element of
+     *          @code{owner}, or nowhere if @code{owner} is @code{nullptr} since the element has been removed
+     *
+     * Anchors of a bucket are linked in a list, and every method of the bucket which changes the indices of its
+     * elements updates them, so that they follow their elements across shifts, splits and merges.
+     */
+    struct __anchor {
+        bucket *owner;
+        size_t index;
+        __anchor *prev, *next;
+        size_t ref;
+    };
+
+    /**
+     * @brief   The links and the size of a bucket, which is all that the sentinels at both ends have, where the
+     *          size of a sentinel is always 0, so that an iterator at the end is in an empty bucket
+     */
+    struct __bucket_links {
         bucket *prev, *next;
-        node *head, *tail;
         size_t size;
+    };
 
-        bucket() : head(new node), tail(new node), size(0) {
-            head->next = tail;
-            tail->prev = head;
+    /**
+     * @brief   A unit in the container, which stores at most approximately sqrt(n) elements
+     *
+     * Elements are stored inline in a ring array whose capacity is a power of two, so that the i-th element of
+     * a bucket lives in @code{data[(start + i) & (capacity - 1)]}. The sentinels are only @code{__bucket_links},
+     * so nothing but their links and sizes is ever accessed.
+     *
+     * The storage is shared with copies of the bucket until either of them is modified, so every modifying method
+     * calls @code{__unshare()} first.
+     */
+    struct bucket : __bucket_links {
+        using __bucket_links::prev;
+        using __bucket_links::next;
+        using __bucket_links::size;
+
+        block *storage;
+        T *data;
+        size_t capacity, start;
+        size_t rank;
+        mutable size_t offset, epoch;
+        bool reversed;
+        __anchor *anchors;
+        __spill_file *spill;
+        std::uint64_t spill_offset;
+
+        bucket() :
+                __bucket_links{nullptr, nullptr, 0}, storage(nullptr), data(nullptr), capacity(0), start(0), rank(0),
+                offset(0), epoch(0), reversed(false), anchors(nullptr), spill(nullptr), spill_offset(0) {}
+
+        explicit bucket(size_t capacity) :
+                __bucket_links{nullptr, nullptr, 0}, storage(block::__create(capacity)), data(storage->data),
+                capacity(capacity), start(0), rank(0), offset(0), epoch(0), reversed(false),
+                anchors(nullptr), spill(nullptr), spill_offset(0) {}
+
+        ~bucket() {
+            __detach_anchors(0, static_cast<size_t>(-1));
+            if (spill != nullptr) __drop_spill();
+            __release_storage();
         }
 
         /**
-         * @brief   Split before the specified position in this bucket
+         * @brief   Write the elements into a region of @code{target} and free the storage, where the elements MUST
+         *          be trivially copyable
+         *
+         * @throw   runtime_error   if the file cannot be written, in which case the bucket is not modified
          */
-        void __split_before(size_t pos) {
-            node *new_last = head;
-            for (size_t i = 0; i < pos; i++)
-                new_last = new_last->next;
-            node *new_first = new_last->next;
+        void __spill_to(__spill_file *target) {
+            std::uint64_t region = target->__allocate(capacity);
+            bool success = __seek_file(target->file, region);
+            auto write_span = [&](const T *first, size_t count) {
+                if (success) success = fwrite(first, sizeof(T), count, target->file) == count;
+            };
+            __for_each_span<const T *>(write_span);
+            if (!success) {
+                target->__free(region, capacity);
+                throw runtime_error();
+            }
+            // the elements are trivially destructible
+            if (storage->ref.fetch_sub(1, std::memory_order_acq_rel) == 1) block::__destroy(storage);
+            storage = nullptr;
+            data = nullptr;
+            start = 0;
+            reversed = false;
+            spill = target;
+            spill_offset = region;
+            target->ref++;
+            target->spills++;
+        }
 
-            auto new_bucket = new bucket;
-            new_bucket->next = next;
-            new_bucket->prev = this;
-            next->prev = new_bucket;
-            next = new_bucket;
+        /**
+         * @brief   Spill like @code{__spill_to}, but keep the bucket in memory if the file cannot be written
+         */
+        void __try_spill_to(__spill_file *target) {
+            try {
+                __spill_to(target);
+            } catch (runtime_error &) {
+            }
+        }
+
+        /**
+         * @brief   Read the elements of a spilled bucket back into a new storage
+         *
+         * A bucket is faulted in on its first access, which does not modify the container logically.
+         *
+         * @throw   runtime_error   if the file cannot be read
+         */
+        void __fault() const {
+            auto self = const_cast<bucket *>(this);
+            block *new_storage = block::__create(capacity);
+            if (!__seek_file(spill->file, spill_offset) ||
+                fread(new_storage->data, sizeof(T), size, spill->file) != size) {
+                block::__destroy(new_storage);
+                throw runtime_error();
+            }
+            spill->faults++;
+            self->__drop_spill();
+            self->storage = new_storage;
+            self->data = new_storage->data;
+        }
 
-            new_bucket->tail->prev = tail->prev;
-            tail->prev->next = new_bucket->tail;
-            new_bucket->head->next = new_first;
-            new_first->prev = new_bucket->head;
+        /**
+         * @brief   Read @code{count} elements of a spilled bucket from the @code{first}-th one into @code{dst}, leaving
+         *          the bucket spilled
+         *
+         * @throw   runtime_error   if the file cannot be read
+         */
+        void __read_spill(T *dst, size_t first, size_t count) const {
+            if (!__seek_file(spill->file, spill_offset + first * sizeof(T)) ||
+                fread(dst, sizeof(T), count, spill->file) != count)
+                throw runtime_error();
+        }
 
-            tail->prev = new_last;
-            new_last->next = tail;
+        /**
+         * @brief   Give the region of a spilled bucket back to its file
+         */
+        void __drop_spill() {
+            spill->__free(spill_offset, capacity);
+            __spill_file::__release(spill);
+            spill = nullptr;
+        }
 
-            new_bucket->size = size - pos;
-            size = pos;
+        void __link_anchor(__anchor *tar_anchor) {
+            tar_anchor->owner = this;
+            tar_anchor->prev = nullptr;
+            tar_anchor->next = anchors;
+            if (anchors != nullptr) anchors->prev = tar_anchor;
+            anchors = tar_anchor;
+        }
 
-            // for (auto i = new_bucket->head->next; i != nullptr; i = i->next)
-            // i->__bucket = new_bucket;
+        void __unlink_anchor(__anchor *tar_anchor) {
+            if (tar_anchor->prev != nullptr) tar_anchor->prev->next = tar_anchor->next;
+            else anchors = tar_anchor->next;
+            if (tar_anchor->next != nullptr) tar_anchor->next->prev = tar_anchor->prev;
+            tar_anchor->owner = nullptr;
         }
 
         /**
-         * @brief   Merge the next bucket
+         * @brief   Invalidate the handles to elements in [first, last), which are being removed
          */
-        void __merge_next() {
-            node *__old_tail = tail, *__old_head = next->head;
-            __old_tail->prev->next = __old_head->next;
-            __old_head->next->prev = __old_tail->prev;
-            delete __old_head;
-            delete __old_tail;
-            tail = next->tail;
+        void __detach_anchors(size_t first, size_t last) {
+            for (__anchor *cur = anchors, *next_anchor; cur != nullptr; cur = next_anchor) {
+                next_anchor = cur->next;
+                if (cur->index >= first && cur->index < last) __unlink_anchor(cur);
+            }
+        }
 
-            size += next->size;
+        /**
+         * @brief   Record that the elements from the @code{pos}-th one have moved by @code{delta}
+         */
+        void __shift_anchors(size_t pos, std::ptrdiff_t delta) {
+            for (__anchor *cur = anchors; cur != nullptr; cur = cur->next)
+                if (cur->index >= pos) cur->index += delta;
+        }
 
-            bucket *__old_bucket = next;
-            __old_bucket->next->prev = this;
-            next = __old_bucket->next;
-            delete __old_bucket;
+        /**
+         * @brief   Record that the elements in [first, last) have moved into @code{tar_bucket} from its
+         *          @code{pos}-th slot
+         */
+        void __move_anchors(size_t first, size_t last, bucket *tar_bucket, size_t pos) {
+            for (__anchor *cur = anchors, *next_anchor; cur != nullptr; cur = next_anchor) {
+                next_anchor = cur->next;
+                if (cur->index < first || cur->index >= last) continue;
+                size_t index = cur->index - first + pos;
+                __unlink_anchor(cur);
+                tar_bucket->__link_anchor(cur);
+                cur->index = index;
+            }
         }
 
         /**
-         * @brief   Copy this bucket
+         * @return  A new bucket sharing the storage of @code{other}
          */
-        static bucket *__copy_bucket(bucket *other) {
+        static bucket *__share(const bucket *other) {
             auto new_bucket = new bucket;
+            new_bucket->storage = other->storage;
+            new_bucket->storage->ref.fetch_add(1, std::memory_order_relaxed);
+            new_bucket->data = other->data;
+            new_bucket->capacity = other->capacity;
+            new_bucket->start = other->start;
             new_bucket->size = other->size;
-            for (auto old_node = other->head->next; old_node != other->tail; old_node = old_node->next) {
-                auto new_node = new node;
-                new_node->value = new T(*(old_node->value));
-                new_bucket->tail->prev->next = new_node;
-                new_node->prev = new_bucket->tail->prev;
-                new_node->next = new_bucket->tail;
-                new_bucket->tail->prev = new_node;
-            }
+            new_bucket->reversed = other->reversed;
             return new_bucket;
         }
 
         /**
-         * @brief   Clear all elements in this bucket
+         * @return  Whether the storage is shared with other buckets or mapped from a file, so that it MUST NOT
+         *          be modified
          */
-        void clear() {
-            node *cur = head->next;
-            while (cur != tail) {
-                node *next_node = cur->next;
-                delete cur;
-                cur = next_node;
+        bool __shared() const {
+            return storage != nullptr &&
+                   (storage->source != nullptr || storage->ref.load(std::memory_order_acquire) > 1);
+        }
+
+        /**
+         * @brief   Drop the reference to the storage, destroying the elements if it is the last one
+         *
+         * Elements in a mapped file are trivially destructible and read-only, so they are left untouched.
+         */
+        void __release_storage() {
+            if (storage == nullptr) return;
+            if (storage->ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                if (storage->source == nullptr) clear();
+                block::__destroy(storage);
             }
-            size = 0;
+            storage = nullptr;
+            data = nullptr;
         }
-    };
 
-  public:
-    class const_iterator;
+        /**
+         * @brief   Move the elements into a new storage with the specified capacity in their logical order, or copy
+         *          them if the old storage is shared
+         */
+        void __reallocate(size_t new_capacity) {
+            if (spill != nullptr) __fault();
+            block *new_storage = block::__create(new_capacity);
+            T *new_data = new_storage->data;
+            if (__shared()) {
+                __copy_to(new_data, std::is_copy_constructible<T>());
+                // the other references may have been dropped concurrently since the check, in which case the old
+                // elements are destroyed here, keeping the size and anchors which now describe the copies
+                if (storage->ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    if (storage->source == nullptr) __destroy_range(0, size);
+                    block::__destroy(storage);
+                }
+            } else {
+                __relocate_to(new_data, 0, size);
+                block::__destroy(storage);
+            }
+            storage = new_storage;
+            data = new_data;
+            capacity = new_capacity;
+            start = 0;
+            reversed = false;
+        }
 
-    class iterator;
+        void __copy_to(T *new_data, std::true_type) const {
+            __copy_elements(new_data, std::is_trivially_copyable<T>());
+        }
 
-  private:
-    bucket *head, *tail;
+        void __copy_elements(T *new_data, std::true_type) const {
+            // a spilled bucket is copied from the file, so that copying it leaves it spilled
+            if (spill != nullptr) __read_spill(new_data, 0, size);
+            else __copy_bytes(new_data, 0, size);
+        }
 
-  public:
-    /**
-     * @brief   Default constructor, which constructs a @code{deque} with no elements
-     */
-    deque() : head(new bucket), tail(new bucket), __size(0) {
-        head->next = tail;
-        tail->prev = head;
-    }
+        void __copy_elements(T *new_data, std::false_type) const {
+            for (size_t i = 0; i < size; i++)
+                new(new_data + i) T(*slot(i));
+        }
+
+        // a container of elements without copy constructor can never be copied, so its storage is never shared
+        void __copy_to(T *, std::false_type) const {}
+
+        /**
+         * @brief   Make sure the storage is not shared with other buckets
+         */
+        void __unshare() {
+            if (spill != nullptr) __fault();
+            if (__shared()) __reallocate(capacity);
+        }
+
+        /**
+         * @brief   Make sure the storage is not shared, and the elements are stored in their logical order
+         *
+         * A reversed bucket is reversed in place here, so that each bucket is reversed at most once no matter how
+         * many times the container is reversed in between.
+         */
+        void __normalize() {
+            __unshare();
+            if (!reversed) return;
+            for (size_t i = 0; i < (size >> 1); i++) {
+                size_t j = size - 1 - i;
+                T temp(std::move(*__raw(i)));
+                __raw(i)->~T();
+                __relocate(__raw(i), __raw(j));
+                new(__raw(j)) T(std::move(temp));
+            }
+            reversed = false;
+        }
+
+        /**
+         * @brief   Move-construct @code{*src} into the uninitialized @code{dst}, then destroy @code{*src}
+         */
+        static void __relocate(T *dst, T *src) {
+            new(dst) T(std::move(*src));
+            src->~T();
+        }
+
+        /**
+         * @brief   Copy the bytes of @code{count} elements from the @code{first}-th one into @code{dst}, which is both
+         *          a copy and a relocation of trivially copyable elements
+         */
+        void __copy_bytes(T *dst, size_t first, size_t count) const {
+            if (count == 0) return;
+            if (spill != nullptr) __fault();
+            if (reversed) {
+                for (size_t i = 0; i < count; i++)
+                    memcpy(static_cast<void *>(dst + i), slot(first + i), sizeof(T));
+                return;
+            }
+            size_t begin = (start + first) & (capacity - 1), first_span = capacity - begin;
+            if (count <= first_span) {
+                memcpy(static_cast<void *>(dst), data + begin, count * sizeof(T));
+            } else {
+                memcpy(static_cast<void *>(dst), data + begin, first_span * sizeof(T));
+                memcpy(static_cast<void *>(dst + first_span), data, (count - first_span) * sizeof(T));
+            }
+        }
+
+        /**
+         * @brief   Relocate @code{count} elements from the @code{first}-th one into the uninitialized array
+         *          @code{dst}
+         */
+        void __relocate_to(T *dst, size_t first, size_t count) {
+            __relocate_to(dst, first, count, std::is_trivially_copyable<T>());
+        }
+
+        void __relocate_to(T *dst, size_t first, size_t count, std::true_type) {
+            __copy_bytes(dst, first, count);
+        }
+
+        void __relocate_to(T *dst, size_t first, size_t count, std::false_type) {
+            for (size_t i = 0; i < count; i++)
+                __relocate(dst + i, slot(first + i));
+        }
+
+        /**
+         * @brief   Relocate @code{count} elements of @code{src} from its @code{first}-th one into the uninitialized
+         *          slots of this bucket from the @code{pos}-th one, one contiguous run of slots at a time
+         *
+         * This bucket MUST NOT be reversed.
+         */
+        void __relocate_from(bucket *src, size_t first, size_t pos, size_t count) {
+            while (count > 0) {
+                size_t begin = (start + pos) & (capacity - 1);
+                size_t run = capacity - begin < count ? capacity - begin : count;
+                src->__relocate_to(data + begin, first, run);
+                first += run;
+                pos += run;
+                count -= run;
+            }
+        }
+
+        /**
+         * @brief   Relocate @code{count} elements from the @code{src}-th slot to the @code{dst}-th slot in this
+         *          normalized bucket, where the two ranges may overlap
+         */
+        void __move_slots(size_t dst, size_t src, size_t count) {
+            __move_slots(dst, src, count, std::is_trivially_copyable<T>());
+        }
+
+        void __move_slots(size_t dst, size_t src, size_t count, std::true_type) {
+            size_t dst_begin = (start + dst) & (capacity - 1), src_begin = (start + src) & (capacity - 1);
+            // a range wrapping around the ring array falls back to moving one by one
+            if (dst_begin + count <= capacity && src_begin + count <= capacity)
+                memmove(static_cast<void *>(data + dst_begin), data + src_begin, count * sizeof(T));
+            else __move_slots(dst, src, count, std::false_type());
+        }
+
+        void __move_slots(size_t dst, size_t src, size_t count, std::false_type) {
+            if (dst < src) {
+                for (size_t i = 0; i < count; i++)
+                    __relocate(__raw(dst + i), __raw(src + i));
+            } else {
+                for (size_t i = count; i > 0; i--)
+                    __relocate(__raw(dst + i - 1), __raw(src + i - 1));
+            }
+        }
+
+        /**
+         * @brief   Destroy @code{count} elements from the @code{first}-th one, which is a no-op for trivially
+         *          destructible elements
+         */
+        void __destroy_range(size_t first, size_t count) {
+            __destroy_range(first, count, std::is_trivially_destructible<T>());
+        }
+
+        void __destroy_range(size_t, size_t, std::true_type) {}
+
+        void __destroy_range(size_t first, size_t count, std::false_type) {
+            for (size_t i = first; i < first + count; i++)
+                slot(i)->~T();
+        }
+
+        /**
+         * @return  The smallest power of two which is not less than @code{n}
+         */
+        static size_t __round_up(size_t n) {
+            size_t result = 1;
+            while (result < n) result <<= 1;
+            return result;
+        }
+
+        /**
+         * @return  The address of the @code{index}-th slot in the storage order, which may lie outside [0, size)
+         */
+        T *__raw(size_t index) const {
+            return data + ((start + index) & (capacity - 1));
+        }
+
+        /**
+         * @return  The address of the @code{index}-th slot, which MUST lie inside [0, size) if the bucket is
+         *          reversed
+         */
+        T *slot(size_t index) const {
+            if (spill != nullptr) __fault();
+            return __raw(reversed ? size - 1 - index : index);
+        }
+
+        T &operator[](size_t index) const {
+            return *slot(index);
+        }
+
+        bool full() const {
+            return size == capacity;
+        }
+
+        /**
+         * @brief   Make sure this bucket can hold at least @code{n} elements
+         */
+        void __reserve(size_t n) {
+            if (n > capacity) __reallocate(__round_up(n));
+        }
+
+        /**
+         * Pushing or popping at either side of a reversed bucket works on the other side of its storage, so that it
+         * is never reversed in place.
+         */
+        template <typename... Args>
+        void emplace_back(Args &&... args) {
+            __unshare();
+            if (reversed) __construct_front(std::forward<Args>(args)...);
+            else __construct_back(std::forward<Args>(args)...);
+        }
+
+        template <typename... Args>
+        void emplace_front(Args &&... args) {
+            __unshare();
+            if (reversed) __construct_back(std::forward<Args>(args)...);
+            else __construct_front(std::forward<Args>(args)...);
+            if (anchors != nullptr) __shift_anchors(0, 1);
+        }
+
+        void pop_back() {
+            __unshare();
+            if (anchors != nullptr) __detach_anchors(size - 1, size);
+            if (reversed) __destroy_front();
+            else __destroy_back();
+        }
+
+        void pop_front() {
+            __unshare();
+            if (anchors != nullptr) {
+                __detach_anchors(0, 1);
+                __shift_anchors(1, -1);
+            }
+            if (reversed) __destroy_back();
+            else __destroy_front();
+        }
+
+        template <typename... Args>
+        void __construct_back(Args &&... args) {
+            new(__raw(size)) T(std::forward<Args>(args)...);
+            size++;
+        }
+
+        template <typename... Args>
+        void __construct_front(Args &&... args) {
+            new(__raw(capacity - 1)) T(std::forward<Args>(args)...);
+            start = (start + capacity - 1) & (capacity - 1);
+            size++;
+        }
+
+        void __destroy_back() {
+            __raw(size - 1)->~T();
+            size--;
+        }
+
+        void __destroy_front() {
+            __raw(0)->~T();
+            start = (start + 1) & (capacity - 1);
+            size--;
+        }
+
+        /**
+         * @brief   Insert an element before the @code{pos}-th element, moving the shorter side
+         *
+         * The bucket MUST NOT be full.
+         */
+        void insert(size_t pos, T &&value) {
+            __normalize();
+            if (pos < size - pos) {
+                start = (start + capacity - 1) & (capacity - 1);
+                __move_slots(0, 1, pos);
+            } else {
+                __move_slots(pos + 1, pos, size - pos);
+            }
+            new(slot(pos)) T(std::move(value));
+            size++;
+            if (anchors != nullptr) __shift_anchors(pos, 1);
+        }
+
+        /**
+         * @brief   Remove @code{count} elements from the @code{pos}-th element, moving the shorter side
+         */
+        void erase(size_t pos, size_t count = 1) {
+            __normalize();
+            if (anchors != nullptr) {
+                __detach_anchors(pos, pos + count);
+                __shift_anchors(pos + count, -static_cast<std::ptrdiff_t>(count));
+            }
+            __destroy_range(pos, count);
+            if (pos < size - pos - count) {
+                __move_slots(count, 0, pos);
+                start = (start + count) & (capacity - 1);
+            } else {
+                __move_slots(pos, pos + count, size - pos - count);
+            }
+            size -= count;
+        }
+
+        /**
+         * @brief   Split before the specified position in this bucket, moving the rest into an empty bucket
+         *
+         * @param   new_bucket  An empty bucket whose capacity is not less than @code{size - pos}
+         */
+        void __split_before(size_t pos, bucket *new_bucket) {
+            __normalize();
+            __move_anchors(pos, size, new_bucket, 0);
+            __relocate_to(new_bucket->data, pos, size - pos);
+            new_bucket->size = size - pos;
+            size = pos;
+
+            new_bucket->next = next;
+            new_bucket->prev = this;
+            next->prev = new_bucket;
+            next = new_bucket;
+        }
+
+        /**
+         * @brief   Merge the next bucket
+         *
+         * Only the elements of the smaller bucket are moved; the storage of the larger one is kept.
+         *
+         * @return  The next bucket, which is empty and unlinked after merging
+         */
+        bucket *__merge_next() {
+            bucket *__old_bucket = next;
+            __normalize();
+            __old_bucket->__normalize();
+            __old_bucket->__move_anchors(0, __old_bucket->size, this, size);
+            // an embedded storage never leaves the bucket embedded with it
+            if (size >= __old_bucket->size || storage->embedded || __old_bucket->storage->embedded) {
+                __reserve(size + __old_bucket->size);
+                __relocate_from(__old_bucket, 0, size, __old_bucket->size);
+            } else {
+                __old_bucket->__reserve(size + __old_bucket->size);
+                __old_bucket->start = (__old_bucket->start + __old_bucket->capacity - size) &
+                                      (__old_bucket->capacity - 1);
+                __old_bucket->__relocate_from(this, 0, 0, size);
+                std::swap(storage, __old_bucket->storage);
+                std::swap(data, __old_bucket->data);
+                std::swap(capacity, __old_bucket->capacity);
+                std::swap(start, __old_bucket->start);
+            }
+            size += __old_bucket->size;
+            __old_bucket->size = 0;
+
+            __old_bucket->next->prev = this;
+            next = __old_bucket->next;
+            return __old_bucket;
+        }
+
+        /**
+         * @brief   Call @code{f(pointer, count)} on each contiguous span of elements, which are at most two since
+         *          the ring array may wrap around, or each single element in order if the bucket is reversed
+         *
+         * A spilled bucket visited through const pointers is read into a temporary array instead, which is a
+         * single span, so that reading it leaves it spilled.
+         */
+        template <typename Pointer, typename Function>
+        void __for_each_span(Function &f) const {
+            if (size == 0) return;
+            if (spill != nullptr && std::is_const<typename std::remove_pointer<Pointer>::type>::value) {
+                auto buffer = static_cast<T *>(::operator new(size * sizeof(T)));
+                try {
+                    __read_spill(buffer, 0, size);
+                    f(static_cast<Pointer>(buffer), size);
+                } catch (...) {
+                    ::operator delete(buffer);
+                    throw;
+                }
+                ::operator delete(buffer);
+                return;
+            }
+            if (spill != nullptr) __fault();
+            if (reversed) {
+                for (size_t i = 0; i < size; i++)
+                    f(static_cast<Pointer>(slot(i)), 1);
+                return;
+            }
+            size_t first_span = capacity - start;
+            if (size <= first_span) {
+                f(static_cast<Pointer>(data + start), size);
+            } else {
+                f(static_cast<Pointer>(data + start), first_span);
+                f(static_cast<Pointer>(data), size - first_span);
+            }
+        }
+
+        /**
+         * @brief   Clear all elements in this bucket, whose storage MUST NOT be shared
+         */
+        void clear() {
+            __detach_anchors(0, static_cast<size_t>(-1));
+            if (spill != nullptr) {
+                // spilled elements are trivially destructible
+                __drop_spill();
+                start = size = 0;
+                reversed = false;
+                return;
+            }
+            __destroy_range(0, size);
+            start = size = 0;
+            reversed = false;
+        }
+    };
+
+  public:
+    class const_iterator;
+
+    class iterator;
+
+    class handle;
+
+  private:
+    bucket *head, *tail;
+    __bucket_links __sentinels[2] = {};
+
+    /**
+     * @brief   A bucket embedded in the container with @code{InlineCapacity} slots, together with its storage
+     *
+     * The embedded bucket is handed out by @code{__acquire_bucket} when it is not linked and large enough, and by
+     * @code{__acquire_end_bucket} whenever it is not linked, and it is never kept in the pool or moved to another
+     * container. Its storage is never freed, and never leaves the
+     * embedded bucket: merging keeps it in place, and snapshots copy it instead of sharing it.
+     */
+    struct __embedded {
+        block header;
+        bucket owner;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type slots[InlineCapacity];
+
+        __embedded() {
+            header.embedded = true;
+            header.data = reinterpret_cast<T *>(slots);
+            __attach();
+        }
+
+        /**
+         * @brief   Make the embedded bucket use the embedded storage, where both of them MUST be empty
+         */
+        void __attach() {
+            header.ref.store(1, std::memory_order_relaxed);
+            owner.storage = &header;
+            owner.data = header.data;
+            owner.capacity = InlineCapacity;
+            owner.start = owner.size = 0;
+            owner.reversed = false;
+        }
+    };
+
+    struct __no_embedded {};
+
+    using __has_embedded = std::integral_constant<bool, InlineCapacity != 0>;
+
+    typename std::conditional<InlineCapacity != 0, __embedded, __no_embedded>::type __buffer;
+    bool __inline_used = false;
+
+    bucket *__inline_bucket() const {
+        return __inline_bucket(__has_embedded());
+    }
+    bucket *__inline_bucket(std::false_type) const {
+        return nullptr;
+    }
+    bucket *__inline_bucket(std::true_type) const {
+        return const_cast<bucket *>(&__buffer.owner);
+    }
+
+    /**
+     * @brief   Destroy the elements of the embedded bucket, which is unlinked, and make it available again
+     */
+    void __release_inline(std::false_type) {}
+    void __release_inline(std::true_type) {
+        bucket *owner = &__buffer.owner;
+        owner->__detach_anchors(0, static_cast<size_t>(-1));
+        if (owner->storage != nullptr && owner->storage->embedded) owner->clear();
+        else owner->__release_storage();
+        __buffer.__attach();
+        owner->epoch = 0;
+        owner->prev = owner->next = nullptr;
+        __inline_used = false;
+    }
+
+    /**
+     * @brief   Replace the embedded bucket with a bucket allocated elsewhere at the same position
+     *
+     * @return  The new bucket
+     */
+    bucket *__evict_inline(std::false_type) {
+        return nullptr;
+    }
+    bucket *__evict_inline(std::true_type) {
+        bucket *owner = &__buffer.owner, *replacement;
+        if (owner->storage->embedded) {
+            replacement = __acquire_bucket(owner->capacity);
+            owner->__relocate_to(replacement->data, 0, owner->size);
+            replacement->size = owner->size;
+            owner->size = 0;
+        } else {
+            // move the allocated storage rather than the elements
+            replacement = new bucket;
+            std::swap(replacement->storage, owner->storage);
+            std::swap(replacement->data, owner->data);
+            std::swap(replacement->capacity, owner->capacity);
+            std::swap(replacement->start, owner->start);
+            std::swap(replacement->size, owner->size);
+            std::swap(replacement->reversed, owner->reversed);
+        }
+        owner->__move_anchors(0, replacement->size, replacement, 0);
+        replacement->prev = owner->prev;
+        replacement->next = owner->next;
+        owner->prev->next = replacement;
+        owner->next->prev = replacement;
+        __index_dirty = true;
+        __release_bucket(owner);
+        return replacement;
+    }
+
+    /**
+     * @brief   Exchange the contents of the embedded buckets of two containers, which are both unlinked
+     *
+     * Elements in an embedded storage are moved into the other embedded storage, while an allocated storage is
+     * exchanged as a whole.
+     */
+    void __exchange_inline(deque &, std::false_type) {}
+    void __exchange_inline(deque &other, std::true_type) {
+        bucket *mine = &__buffer.owner, *theirs = &other.__buffer.owner;
+        mine->__normalize();
+        theirs->__normalize();
+        if (mine->storage->embedded && theirs->storage->embedded) {
+            size_t common = mine->size < theirs->size ? mine->size : theirs->size;
+            for (size_t i = 0; i < common; i++) {
+                T temp(std::move(*mine->slot(i)));
+                mine->slot(i)->~T();
+                bucket::__relocate(mine->slot(i), theirs->slot(i));
+                new(theirs->slot(i)) T(std::move(temp));
+            }
+            for (size_t i = common; i < mine->size; i++)
+                bucket::__relocate(theirs->slot(i), mine->slot(i));
+            for (size_t i = common; i < theirs->size; i++)
+                bucket::__relocate(mine->slot(i), theirs->slot(i));
+            std::swap(mine->size, theirs->size);
+            // an empty embedded bucket is handed out as a new one, which starts at the beginning of its storage
+            if (mine->size == 0) mine->start = 0;
+            if (theirs->size == 0) theirs->start = 0;
+        } else if (mine->storage->embedded || theirs->storage->embedded) {
+            __embedded &from = mine->storage->embedded ? __buffer : other.__buffer;
+            __embedded &to = mine->storage->embedded ? other.__buffer : __buffer;
+            bucket allocated;
+            std::swap(allocated.storage, to.owner.storage);
+            std::swap(allocated.data, to.owner.data);
+            std::swap(allocated.capacity, to.owner.capacity);
+            std::swap(allocated.start, to.owner.start);
+            std::swap(allocated.size, to.owner.size);
+            to.__attach();
+            from.owner.__relocate_to(to.owner.data, 0, from.owner.size);
+            to.owner.size = from.owner.size;
+            from.owner.size = 0;
+            std::swap(allocated.storage, from.owner.storage);
+            std::swap(allocated.data, from.owner.data);
+            std::swap(allocated.capacity, from.owner.capacity);
+            std::swap(allocated.start, from.owner.start);
+            std::swap(allocated.size, from.owner.size);
+            // allocated now holds the empty embedded storage of from, which MUST NOT be released
+            allocated.storage = nullptr;
+        } else {
+            std::swap(mine->storage, theirs->storage);
+            std::swap(mine->data, theirs->data);
+            std::swap(mine->capacity, theirs->capacity);
+            std::swap(mine->start, theirs->start);
+            std::swap(mine->size, theirs->size);
+        }
+        mine->epoch = theirs->epoch = 0;
+        __anchor *mine_anchors = mine->anchors, *theirs_anchors = theirs->anchors;
+        mine->anchors = theirs->anchors = nullptr;
+        for (__anchor *cur = mine_anchors, *next_anchor; cur != nullptr; cur = next_anchor) {
+            next_anchor = cur->next;
+            theirs->__link_anchor(cur);
+        }
+        for (__anchor *cur = theirs_anchors, *next_anchor; cur != nullptr; cur = next_anchor) {
+            next_anchor = cur->next;
+            mine->__link_anchor(cur);
+        }
+    }
+
+    /**
+     * @brief   Unlink the embedded bucket if it is linked
+     *
+     * @return  The bucket before it, or @code{nullptr} if it is not linked
+     */
+    bucket *__unlink_inline() {
+        if (!__inline_used) return nullptr;
+        bucket *owner = __inline_bucket(), *prev_bucket = owner->prev;
+        prev_bucket->next = owner->next;
+        owner->next->prev = prev_bucket;
+        owner->prev = owner->next = nullptr;
+        return prev_bucket;
+    }
+
+    /**
+     * @return  Whether pushing at either side next to @code{tar_bucket} constructs a new bucket, where the embedded
+     *          bucket is always filled up first
+     */
+    bool __saturated(const bucket *tar_bucket) {
+        return tar_bucket->full() || (tar_bucket->size > NEW_PARA() && tar_bucket != __inline_bucket());
+    }
+
+    /**
+     * @return  Whether @code{tar_bucket} should be split after inserting in the middle, where the embedded bucket is
+     *          split only when it is full
+     */
+    bool __oversized(const bucket *tar_bucket) {
+        return tar_bucket->size > SPLIT_PARA() && tar_bucket != __inline_bucket();
+    }
+
+    // algorithms working on whole buckets, see deque_algorithm.hpp
+    friend struct __deque_algorithm;
+
+  private:
+    /**
+     * @brief   An index over the sizes of buckets, used for positional access
+     *
+     * @code{__index_bucket[r]} is the r-th bucket, whose @code{rank} is r, and @code{__index_tree} is a Fenwick tree
+     * over their sizes. Changing the size of a bucket updates the tree in O(log n) time, while adding or removing
+     * buckets only marks the index dirty, and it will be rebuilt in O(sqrt n) time by the next positional query.
+     */
+    mutable bucket **__index_bucket = nullptr;
+    mutable size_t *__index_tree = nullptr;
+    mutable size_t __index_capacity = 0, __index_count = 0;
+    mutable bool __index_dirty = true;
+
+    void __index_rebuild() const {
+        size_t count = 0;
+        for (auto cur = head->next; cur != tail; cur = cur->next)
+            count++;
+        if (count > __index_capacity) {
+            delete[] __index_bucket;
+            delete[] __index_tree;
+            __index_capacity = bucket::__round_up(count);
+            __index_bucket = new bucket *[__index_capacity];
+            __index_tree = new size_t[__index_capacity + 1];
+        }
+        __index_count = count;
+        size_t rank = 0;
+        for (auto cur = head->next; cur != tail; cur = cur->next) {
+            cur->rank = rank;
+            __index_bucket[rank] = cur;
+            __index_tree[++rank] = cur->size;
+        }
+        for (size_t i = 1; i <= count; i++) {
+            size_t j = i + (i & -i);
+            if (j <= count) __index_tree[j] += __index_tree[i];
+        }
+        __index_dirty = false;
+        __cursor = nullptr;
+    }
+
+    /**
+     * @brief   Record that the size of @code{tar_bucket} has changed by @code{delta}
+     */
+    void __index_add(const bucket *tar_bucket, size_t delta) {
+        if (__index_dirty) return;
+        for (size_t i = tar_bucket->rank + 1; i <= __index_count; i += i & -i)
+            __index_tree[i] += delta;
+    }
+
+    /**
+     * @return  The number of elements before @code{tar_bucket}
+     */
+    size_t __offset_of(const bucket *tar_bucket) const {
+        if (tar_bucket == tail) return __size;
+        if (tar_bucket == head->next) return 0;
+        if (__index_dirty) __index_rebuild();
+        size_t offset = 0;
+        for (size_t i = tar_bucket->rank; i > 0; i -= i & -i)
+            offset += __index_tree[i];
+        return offset;
+    }
+
+    /**
+     * @brief   Find the bucket containing the @code{pos}-th element, where @code{pos} MUST NOT exceed @code{__size}
+     *
+     * @return  The found bucket, and @code{pos} is set to the index of the element inside it
+     */
+    bucket *__locate(size_t &pos) const {
+        if (pos == __size) {
+            pos = 0;
+            return tail;
+        }
+        // the first bucket needs no index, so a container with a single bucket never builds it
+        if (pos < head->next->size) return head->next;
+        if (__index_dirty) __index_rebuild();
+        size_t rank = 0, step = 1;
+        while ((step << 1) <= __index_count) step <<= 1;
+        for (; step > 0; step >>= 1) {
+            if (rank + step <= __index_count && __index_tree[rank + step] <= pos) {
+                rank += step;
+                pos -= __index_tree[rank];
+            }
+        }
+        return __index_bucket[rank];
+    }
+
+    /**
+     * @brief   Cached offsets of buckets, used for calculating distances between iterators
+     *
+     * Every element is given a virtual coordinate, and the index of an element is its coordinate minus
+     * @code{__front}, the coordinate of the first element. Pushing or popping at either side keeps the coordinates of
+     * other elements, so only inserting or removing in the middle changes them, which increases @code{__epoch}.
+     * A bucket caches the coordinate of its first element in @code{offset}, which is valid iff its @code{epoch}
+     * equals @code{__epoch}.
+     */
+    size_t __front = 0;
+    size_t __epoch = 1;
+
+    /**
+     * @return  The number of elements before @code{tar_bucket}, in O(1) time if its cached offset is valid
+     */
+    size_t __cached_offset(const bucket *tar_bucket) const {
+        if (tar_bucket == tail) return __size;
+        if (tar_bucket->epoch != __epoch) {
+            tar_bucket->offset = __front + __offset_of(tar_bucket);
+            tar_bucket->epoch = __epoch;
+        }
+        return tar_bucket->offset - __front;
+    }
+
+    /**
+     * @brief   The bucket of the last positional access, from which the next one starts
+     *
+     * Accessing an index in the same or an adjacent bucket takes O(1) time while the cached offset of the cursor is
+     * valid, so that a loop over consecutive indices takes amortized O(1) time per access. Buckets are added or
+     * removed only with the index marked dirty, so the cursor is used only while the index is clean, and it is dropped
+     * whenever the index is rebuilt. Only non-const accesses move the cursor, so that a const access never writes it.
+     */
+    mutable bucket *__cursor = nullptr;
+
+    /**
+     * @brief   Find the bucket containing the @code{pos}-th element, starting from the cursor, where @code{pos} MUST
+     *          be less than @code{__size}
+     *
+     * @return  The found bucket, and @code{pos} is set to the index of the element inside it
+     */
+    bucket *__access(size_t &pos) {
+        if (__cursor != nullptr && !__index_dirty) {
+            bucket *cur = __cursor;
+            size_t offset = __cached_offset(cur);
+            if (pos < offset) {
+                cur = cur->prev;
+                if (cur != head && pos >= offset - cur->size) {
+                    pos -= offset - cur->size;
+                    return __cursor = cur;
+                }
+            } else if (pos < offset + cur->size) {
+                pos -= offset;
+                return cur;
+            } else {
+                offset += cur->size;
+                cur = cur->next;
+                if (cur != tail && pos < offset + cur->size) {
+                    pos -= offset;
+                    return __cursor = cur;
+                }
+            }
+        }
+        bucket *result = __locate(pos);
+        return __cursor = result;
+    }
+
+    /**
+     * @brief   Find the element @code{n} after the @code{index}-th element of @code{cur}
+     *
+     * It takes O(1) time if the result lies in @code{cur} or its neighbors, and O(log n) time otherwise.
+     *
+     * @return  The bucket of the result, and @code{index} is set to its index inside the bucket
+     * @throw   invalid_iterator    if the result exceeds @code{begin()} or @code{end()}
+     */
+    bucket *__seek(const bucket *cur, size_t &index, std::ptrdiff_t n) const {
+        size_t offset = __cached_offset(cur);
+        size_t target = offset + index + n;
+        if (n < 0 ? static_cast<size_t>(-n) > offset + index : target > __size) throw invalid_iterator();
+        if (target >= offset + cur->size) {
+            if (cur == tail) {
+                index = 0;
+                return tail;
+            }
+            bucket *next_bucket = cur->next;
+            if (target < offset + cur->size + next_bucket->size || next_bucket == tail) {
+                index = target - offset - cur->size;
+                return next_bucket;
+            }
+        } else if (target >= offset) {
+            index = target - offset;
+            return const_cast<bucket *>(cur);
+        } else {
+            bucket *prev_bucket = cur->prev;
+            if (target + prev_bucket->size >= offset) {
+                index = target + prev_bucket->size - offset;
+                return prev_bucket;
+            }
+        }
+        index = target;
+        return __locate(index);
+    }
+
+    /**
+     * @return  The capacity of a bucket newly constructed at either side
+     */
+    size_t __new_capacity() {
+        return bucket::__round_up(Policy::capacity(__size));
+    }
+
+    /**
+     * @return  The number of elements to put into a bucket when filling buckets in bulk
+     */
+    size_t __fill_size() {
+        return Policy::fill(__size);
+    }
+
+    /**
+     * @brief   Merge @code{tar_bucket} with its neighbors if they are small enough
+     */
+    void __rebalance(bucket *tar_bucket) {
+        if (tar_bucket == head || tar_bucket == tail) return;
+        if (tar_bucket->prev != head && tar_bucket->size + tar_bucket->prev->size < MERGE_PARA()) {
+            tar_bucket = tar_bucket->prev;
+            __merge(tar_bucket);
+            __index_dirty = true;
+        }
+        if (tar_bucket->next != tail && tar_bucket->size + tar_bucket->next->size < MERGE_PARA()) {
+            __merge(tar_bucket);
+            __index_dirty = true;
+        }
+    }
+
+    /**
+     * @brief   An iterator repeating a single value, used for inserting copies of it
+     */
+    struct __repeat_iterator {
+        const T *value;
+        size_t count;
+
+        const T &operator*() const {
+            return *value;
+        }
+
+        __repeat_iterator &operator++() {
+            count--;
+            return *this;
+        }
+
+        bool operator!=(const __repeat_iterator &rhs) const {
+            return count != rhs.count;
+        }
+    };
+
+    /**
+     * @brief   Insert elements in [first, last) before @code{pos}
+     *
+     * The bucket of @code{pos} is split at most once, and the elements are appended to the bucket before the
+     * insertion point until it is filled, and then to newly constructed buckets. Only the bucket at the end of the
+     * inserted elements may be merged with its next bucket.
+     */
+    template <typename InputIterator>
+    iterator __insert_range(iterator pos, InputIterator first, InputIterator last) {
+        if (pos.__deque != this) throw invalid_iterator();
+        if (!(first != last)) return pos;
+        size_t offset = pos.pos(), old_size = __size;
+        bucket *cur_bucket, *next_bucket;
+        if (pos.__index == 0) {
+            next_bucket = pos.__bucket;
+            cur_bucket = next_bucket->prev;
+        } else {
+            cur_bucket = pos.__bucket;
+            __split(cur_bucket, pos.__index);
+            next_bucket = cur_bucket->next;
+        }
+        __index_dirty = true;
+        if (next_bucket != tail) __epoch++;
+        size_t fill = __fill_size();
+        for (; first != last; ++first) {
+            if (cur_bucket == head || cur_bucket->size >= fill) {
+                fill = __fill_size();
+                auto new_bucket = __acquire_bucket(bucket::__round_up(fill));
+                __link_after(cur_bucket, new_bucket);
+                cur_bucket = new_bucket;
+            } else if (cur_bucket->full()) {
+                cur_bucket->__reserve(fill);
+            }
+            cur_bucket->emplace_back(*first);
+            __size++;
+        }
+        if (next_bucket != tail && cur_bucket->size + next_bucket->size < MERGE_PARA())
+            __merge(cur_bucket);
+        __spill_tick(__size - old_size);
+        auto tar_bucket = __locate(offset);
+        return iterator(this, tar_bucket, offset);
+    }
+
+    /**
+     * @brief   Append @code{count} elements from @code{first} to an empty container, filling buckets to the size for
+     *          @code{count} elements directly
+     */
+    template <typename InputIterator>
+    void __fill(InputIterator first, size_t count) {
+        size_t fill = Policy::fill(count);
+        while (count > 0) {
+            size_t batch = count < fill ? count : fill;
+            auto new_bucket = __acquire_bucket(bucket::__round_up(batch));
+            __link_after(tail->prev, new_bucket);
+            for (size_t i = 0; i < batch; i++, ++first) {
+                new(new_bucket->slot(new_bucket->size)) T(*first);
+                new_bucket->size++;
+                __size++;
+            }
+            count -= batch;
+        }
+    }
+
+    /**
+     * @brief   Replace the elements with the ones in [first, last), counting them first if the range can be
+     *          traversed twice
+     */
+    template <typename ForwardIterator>
+    void __assign_range(ForwardIterator first, ForwardIterator last, std::forward_iterator_tag) {
+        size_t count = std::distance(first, last);
+        clear();
+        __fill(first, count);
+    }
+
+    template <typename InputIterator>
+    void __assign_range(InputIterator first, InputIterator last, std::input_iterator_tag) {
+        clear();
+        __insert_range(end(), first, last);
+    }
+
+    /**
+     * @brief   A pool of empty buckets, which keeps the storage of drained buckets for reuse
+     *
+     * Buckets removed from the container are kept in @code{__pool}(linked by @code{next}) as long as they occupy
+     * no more than @code{__pool_limit} bytes in total, or the spill budget if it is less when spilling, and new
+     * buckets are taken from it before allocating.
+     */
+    static constexpr size_t DEFAULT_POOL_LIMIT = 1 << 20;
+
+    bucket *__pool = nullptr;
+    size_t __pool_bytes = 0, __pool_limit = DEFAULT_POOL_LIMIT;
+
+    static size_t __bucket_bytes(const bucket *tar_bucket) {
+        return sizeof(bucket) + tar_bucket->capacity * sizeof(T);
+    }
+
+    /**
+     * @return  The bytes which the pool may occupy
+     */
+    size_t __pool_cap() const {
+        return __spill != nullptr && __spill_budget < __pool_limit ? __spill_budget : __pool_limit;
+    }
+
+    /**
+     * @return  An empty and unlinked bucket for pushing at either side, which is the embedded bucket whenever it is
+     *          not linked, since a bucket pushed into is only filled up to its capacity
+     */
+    bucket *__acquire_end_bucket() {
+        if (InlineCapacity > 0 && !__inline_used) {
+            __inline_used = true;
+            return __inline_bucket();
+        }
+        return __acquire_bucket(__new_capacity());
+    }
+
+    /**
+     * @return  An empty and unlinked bucket which can hold at least @code{capacity} elements
+     */
+    bucket *__acquire_bucket(size_t capacity) {
+        if (InlineCapacity >= capacity && !__inline_used && InlineCapacity > 0) {
+            __inline_used = true;
+            return __inline_bucket();
+        }
+        while (__pool != nullptr) {
+            bucket *cur = __pool;
+            __pool = cur->next;
+            __pool_bytes -= __bucket_bytes(cur);
+            if (cur->capacity >= capacity) {
+                cur->next = nullptr;
+                return cur;
+            }
+            delete cur;
+        }
+        return new bucket(capacity);
+    }
+
+    /**
+     * @brief   Destroy the elements in an unlinked bucket, and keep it in the pool if there is room
+     *
+     * A bucket whose storage is shared is never kept, since the storage is still used by other containers, and
+     * neither is a spilled bucket, which has no storage.
+     */
+    void __release_bucket(bucket *tar_bucket) {
+        if (tar_bucket == __inline_bucket()) {
+            __release_inline(__has_embedded());
+            return;
+        }
+        if (tar_bucket->spill != nullptr || tar_bucket->__shared() ||
+            __pool_bytes + __bucket_bytes(tar_bucket) > __pool_cap()) {
+            delete tar_bucket;
+            return;
+        }
+        tar_bucket->clear();
+        tar_bucket->epoch = 0;
+        tar_bucket->prev = nullptr;
+        tar_bucket->next = __pool;
+        __pool = tar_bucket;
+        __pool_bytes += __bucket_bytes(tar_bucket);
+    }
+
+    /**
+     * @brief   Free buckets in the pool until it occupies no more than @code{limit} bytes
+     */
+    void __trim_pool(size_t limit) {
+        while (__pool != nullptr && __pool_bytes > limit) {
+            bucket *cur = __pool;
+            __pool = cur->next;
+            __pool_bytes -= __bucket_bytes(cur);
+            delete cur;
+        }
+    }
+
+    /**
+     * @return  A copy of @code{other}, which is not linked
+     */
+    bucket *__copy_bucket(const bucket *other) {
+        auto new_bucket = __acquire_bucket(bucket::__round_up(other->size));
+        other->__copy_to(new_bucket->data, std::true_type());
+        new_bucket->size = other->size;
+        return new_bucket;
+    }
+
+#ifdef SJTU_DEQUE_STATS
+    size_t __stats_splits = 0, __stats_merges = 0;
+#endif
+
+    /**
+     * @brief   Split @code{tar_bucket} before its @code{pos}-th element into a new bucket
+     */
+    void __split(bucket *tar_bucket, size_t pos) {
+        SJTU_DEQUE_COUNT(splits);
+        __index_dirty = true;
+        tar_bucket->__split_before(pos, __acquire_bucket(tar_bucket->capacity));
+    }
+
+    /**
+     * @brief   Merge the bucket following @code{tar_bucket} into it
+     */
+    void __merge(bucket *tar_bucket) {
+        SJTU_DEQUE_COUNT(merges);
+        __index_dirty = true;
+        __release_bucket(tar_bucket->__merge_next());
+    }
+
+    /**
+     * @brief   Link @code{new_bucket} after @code{pos}
+     */
+    void __link_after(bucket *pos, bucket *new_bucket) {
+        __index_dirty = true;
+        new_bucket->prev = pos;
+        new_bucket->next = pos->next;
+        pos->next->prev = new_bucket;
+        pos->next = new_bucket;
+    }
+
+    /**
+     * @brief   Unlink and release a bucket, destroying its elements
+     */
+    void __remove_bucket(bucket *tar_bucket) {
+        __index_dirty = true;
+        tar_bucket->prev->next = tar_bucket->next;
+        tar_bucket->next->prev = tar_bucket->prev;
+        __release_bucket(tar_bucket);
+    }
+
+
+  public:
+    /**
+     * @brief   Default constructor, which constructs a @code{deque} with no elements
+     */
+    deque() : head(static_cast<bucket *>(&__sentinels[0])), tail(static_cast<bucket *>(&__sentinels[1])), __size(0) {
+        head->next = tail;
+        tail->prev = head;
+    }
+
+    /**
+     * @brief   Copy constructor
+     */
+    deque(const deque &other) : deque() {
+        __size = other.__size;
+        for (auto old_bucket = other.head->next; old_bucket != other.tail; old_bucket = old_bucket->next)
+            __link_after(tail->prev, __copy_bucket(old_bucket));
+    }
+
+    /**
+     * @brief   Construct a @code{deque} with @code{count} copies of @code{value}, filling buckets with balanced sizes
+     *          directly
+     */
+    deque(size_t count, const T &value) : deque() {
+        __fill(__repeat_iterator{&value, count}, count);
+    }
+
+    /**
+     * @brief   Construct a @code{deque} with @code{count} value-initialized elements
+     */
+    explicit deque(size_t count) : deque(count, T()) {}
+
+    /**
+     * @brief   Construct a @code{deque} with the elements in [first, last)
+     *
+     * If the iterators are at least forward iterators, the elements are counted first and buckets with balanced sizes
+     * are filled directly; otherwise they are appended one by one.
+     */
+    template <typename InputIterator,
+              typename = typename std::enable_if<!std::is_integral<InputIterator>::value>::type>
+    deque(InputIterator first, InputIterator last) : deque() {
+        __assign_range(first, last, typename __iterator_category<InputIterator>::type());
+    }
+
+    deque(std::initializer_list<T> list) : deque() {
+        __fill(list.begin(), list.size());
+    }
+
+    /**
+     * @brief   Move constructor, which leaves @code{other} empty
+     */
+    deque(deque &&other) : deque() {
+        __swap(other);
+    }
+
+    /**
+     * @brief   Destructor
+     */
+    ~deque() {
+        clear();
+        __trim_pool(0);
+        if (__spill != nullptr) __spill_file::__release(__spill);
+        delete[] __index_bucket;
+        delete[] __index_tree;
+    }
+
+    /**
+     * @brief   Assignment operator
+     */
+    deque &operator=(const deque &other) {
+        if (this == &other) return *this;
+        clear();
+        __size = other.__size;
+        for (auto old_bucket = other.head->next; old_bucket != other.tail; old_bucket = old_bucket->next)
+            __link_after(tail->prev, __copy_bucket(old_bucket));
+        return *this;
+    }
+
+    /**
+     * @brief   Move assignment operator, which leaves @code{other} empty
+     */
+    deque &operator=(deque &&other) {
+        if (this == &other) return *this;
+        clear();
+        __swap(other);
+        return *this;
+    }
+
+    deque &operator=(std::initializer_list<T> list) {
+        assign(list);
+        return *this;
+    }
+
+    /**
+     * @brief   Replace the elements with @code{count} copies of @code{value}, filling buckets with balanced sizes
+     *          directly
+     */
+    void assign(size_t count, const T &value) {
+        // copy first, since value may refer to an element of this container
+        T copy(value);
+        clear();
+        __fill(__repeat_iterator{&copy, count}, count);
+    }
+
+    /**
+     * @brief   Replace the elements with the ones in [first, last), which MUST NOT point to this container
+     */
+    template <typename InputIterator,
+              typename = typename std::enable_if<!std::is_integral<InputIterator>::value>::type>
+    void assign(InputIterator first, InputIterator last) {
+        __assign_range(first, last, typename __iterator_category<InputIterator>::type());
+    }
+
+    void assign(std::initializer_list<T> list) {
+        clear();
+        __fill(list.begin(), list.size());
+    }
+
+    /**
+     * @brief   Make a copy which shares buckets with this container
+     *
+     * Unlike the copy constructor, it takes O(sqrt n) time, since buckets are shared rather than copied, and a
+     * bucket is copied only when either container modifies it(including accessing it through non-const methods).
+     * It suits snapshots which are rarely modified. Note that references to elements obtained before taking the
+     * snapshot refer to the shared storage.
+     *
+     * A snapshot has its own index and cached offsets, so snapshots taken in one thread can be handed to other
+     * threads and read through const references concurrently. The container itself is not safe to read
+     * concurrently, see @code{deque}.
+     */
+    deque snapshot() const {
+        deque result;
+        result.__size = __size;
+        for (auto old_bucket = head->next; old_bucket != tail; old_bucket = old_bucket->next) {
+            if (old_bucket->spill != nullptr) old_bucket->__fault();
+            result.__link_after(result.tail->prev, old_bucket->storage->embedded ? result.__copy_bucket(old_bucket)
+                                                                                 : bucket::__share(old_bucket));
+        }
+        return result;
+    }
+
+  private:
+    /**
+     * @brief   The header of a file written by @code{save}
+     *
+     * It is followed by the sizes of buckets, and then the elements of all buckets in order, which start at a
+     * multiple of @code{alignof(T)}, so that a mapped file can be used as the storage of buckets directly.
+     */
+    struct __file_header {
+        char magic[8];
+        std::uint64_t element_size, size, bucket_count;
+    };
+
+    static const char *__file_magic() {
+        return "SJTUDEQ";
+    }
+
+    static size_t __file_data_offset(size_t bucket_count) {
+        size_t offset = sizeof(__file_header) + bucket_count * sizeof(std::uint64_t);
+        return (offset + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    static bool __check_header(const __file_header &header) {
+        for (size_t i = 0; i < sizeof(header.magic); i++)
+            if (header.magic[i] != __file_magic()[i]) return false;
+        return header.element_size == sizeof(T);
+    }
+
+    /**
+     * @brief   Check that the table of bucket sizes and the elements declared by @code{header} fit in a file of
+     *          @code{length} bytes
+     *
+     * The bounds are checked by division and subtraction, so that a crafted header cannot wrap them around.
+     */
+    static bool __check_layout(const __file_header &header, std::uint64_t length) {
+        return length >= sizeof(__file_header) &&
+               header.bucket_count <= (length - sizeof(__file_header)) / sizeof(std::uint64_t) &&
+               __file_data_offset(header.bucket_count) <= length &&
+               header.size <= (length - __file_data_offset(header.bucket_count)) / sizeof(T);
+    }
+
+  public:
+    /**
+     * @brief   Write all elements into a binary file, writing the storage of buckets as contiguous blocks
+     *
+     * Only available when @code{T} is trivially copyable. The file can be read by @code{load} or
+     * @code{load_mapped} on a machine with the same layout of @code{T}. Spilled buckets are copied from the spill
+     * file one at a time, and stay spilled.
+     *
+     * @throw   runtime_error   if the file cannot be written
+     */
+    void save(const char *path) const {
+        static_assert(std::is_trivially_copyable<T>::value, "save requires trivially copyable elements");
+        FILE *file = fopen(path, "wb");
+        if (file == nullptr) throw runtime_error();
+        __file_header header = {};
+        for (size_t i = 0; i < sizeof(header.magic); i++)
+            header.magic[i] = __file_magic()[i];
+        header.element_size = sizeof(T);
+        header.size = __size;
+        for (auto cur = head->next; cur != tail; cur = cur->next)
+            header.bucket_count++;
+        bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+        for (auto cur = head->next; cur != tail && success; cur = cur->next) {
+            std::uint64_t bucket_size = cur->size;
+            success = fwrite(&bucket_size, sizeof(bucket_size), 1, file) == 1;
+        }
+        size_t padding = __file_data_offset(header.bucket_count) - sizeof(header) -
+                         header.bucket_count * sizeof(std::uint64_t);
+        for (size_t i = 0; i < padding && success; i++)
+            success = fputc(0, file) != EOF;
+        auto write_span = [&](const T *first, size_t count) {
+            if (success) success = fwrite(first, sizeof(T), count, file) == count;
+        };
+        for (auto cur = head->next; cur != tail; cur = cur->next)
+            cur->template __for_each_span<const T *>(write_span);
+        success = fclose(file) == 0 && success;
+        if (!success) throw runtime_error();
+    }
+
+    /**
+     * @brief   Replace the elements with the ones in a file written by @code{save}, reading them into buckets
+     *          directly
+     *
+     * @throw   runtime_error   if the file cannot be read or is not written by @code{save} with the same @code{T},
+     *                          in which case the container is not modified
+     */
+    void load(const char *path) {
+        static_assert(std::is_trivially_copyable<T>::value, "load requires trivially copyable elements");
+        FILE *file = fopen(path, "rb");
+        if (file == nullptr) throw runtime_error();
+        __file_header header = {};
+        std::uint64_t length = 0;
+        bool success = __file_length(file, length) && __seek_file(file, 0) &&
+                       fread(&header, sizeof(header), 1, file) == 1 && __check_header(header) &&
+                       __check_layout(header, length);
+        // the sizes of buckets are checked before allocating anything, and each of them is compared with the
+        // remaining total by subtraction to avoid wrapping around
+        std::uint64_t total = 0;
+        for (std::uint64_t i = 0; success && i < header.bucket_count; i++) {
+            std::uint64_t bucket_size = 0;
+            success = fread(&bucket_size, sizeof(bucket_size), 1, file) == 1 && bucket_size <= header.size - total;
+            total += bucket_size;
+        }
+        success = success && total == header.size && __seek_file(file, __file_data_offset(header.bucket_count));
+        deque result;
+        size_t fill = success ? Policy::fill(header.size) : 0;
+        for (size_t remaining = success ? header.size : 0; remaining > 0 && success;) {
+            size_t count = remaining < fill ? remaining : fill;
+            auto new_bucket = result.__acquire_bucket(bucket::__round_up(count));
+            success = fread(new_bucket->data, sizeof(T), count, file) == count;
+            new_bucket->size = success ? count : 0;
+            result.__link_after(result.tail->prev, new_bucket);
+            result.__size += new_bucket->size;
+            remaining -= count;
+        }
+        fclose(file);
+        if (!success) throw runtime_error();
+        *this = std::move(result);
+    }
+
+#ifdef SJTU_DEQUE_MMAP
+    /**
+     * @brief   Replace the elements with the ones in a file written by @code{save}, using the mapped file as the
+     *          storage of buckets
+     *
+     * It takes O(sqrt n) time rather than reading all elements, since only bucket headers are constructed. The
+     * mapped storage is never written: a bucket is copied into memory once it is modified(including accessing it
+     * through non-const methods), like the buckets shared by @code{snapshot}. The file is unmapped when no bucket
+     * refers to it, and it MUST NOT be modified until then.
+     *
+     * @throw   runtime_error   if the file cannot be mapped or is not written by @code{save} with the same
+     *                          @code{T}, in which case the container is not modified
+     */
+    void load_mapped(const char *path) {
+        static_assert(std::is_trivially_copyable<T>::value, "load_mapped requires trivially copyable elements");
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) throw runtime_error();
+        struct stat file_stat;
+        void *address = MAP_FAILED;
+        size_t length = 0;
+        if (fstat(fd, &file_stat) == 0 && file_stat.st_size >= static_cast<off_t>(sizeof(__file_header))) {
+            length = static_cast<size_t>(file_stat.st_size);
+            address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (address == MAP_FAILED) throw runtime_error();
+
+        auto source = new mapping(address, length);
+        auto header = static_cast<const __file_header *>(address);
+        auto sizes = reinterpret_cast<const std::uint64_t *>(header + 1);
+        bool success = __check_header(*header) && __check_layout(*header, length);
+        std::uint64_t total = 0;
+        for (size_t i = 0; success && i < header->bucket_count; i++) {
+            success = sizes[i] <= header->size - total;
+            total += sizes[i];
+        }
+        success = success && total == header->size;
+
+        deque result;
+        auto data = reinterpret_cast<T *>(static_cast<char *>(address) + __file_data_offset(header->bucket_count));
+        for (size_t i = 0; success && i < header->bucket_count; i++) {
+            if (sizes[i] == 0) continue;
+            auto new_bucket = new bucket;
+            new_bucket->storage = block::__map(source, data);
+            new_bucket->data = data;
+            new_bucket->capacity = bucket::__round_up(sizes[i]);
+            new_bucket->size = sizes[i];
+            result.__link_after(result.tail->prev, new_bucket);
+            result.__size += sizes[i];
+            data += sizes[i];
+        }
+        mapping::__release(source);
+        if (!success) throw runtime_error();
+        *this = std::move(result);
+    }
+#endif
+
+  private:
+    void __swap(deque &other) {
+        // embedded buckets never leave their containers, so they are unlinked before exchanging the lists of buckets,
+        // and then their contents are exchanged and they are linked back at the exchanged positions
+        bucket *mine_prev = __unlink_inline(), *theirs_prev = other.__unlink_inline();
+        bucket *first = head->next, *last = tail->prev;
+        bucket *other_first = other.head->next, *other_last = other.tail->prev;
+        if (other_first != other.tail) {
+            head->next = other_first;
+            other_first->prev = head;
+            tail->prev = other_last;
+            other_last->next = tail;
+        } else {
+            head->next = tail;
+            tail->prev = head;
+        }
+        if (first != tail) {
+            other.head->next = first;
+            first->prev = other.head;
+            other.tail->prev = last;
+            last->next = other.tail;
+        } else {
+            other.head->next = other.tail;
+            other.tail->prev = other.head;
+        }
+        std::swap(__size, other.__size);
+        std::swap(__index_bucket, other.__index_bucket);
+        std::swap(__index_tree, other.__index_tree);
+        std::swap(__index_capacity, other.__index_capacity);
+        std::swap(__index_count, other.__index_count);
+        std::swap(__index_dirty, other.__index_dirty);
+        std::swap(__front, other.__front);
+        std::swap(__epoch, other.__epoch);
+        std::swap(__cursor, other.__cursor);
+        std::swap(__spill, other.__spill);
+        std::swap(__spill_budget, other.__spill_budget);
+        std::swap(__spill_countdown, other.__spill_countdown);
+#ifdef SJTU_DEQUE_STATS
+        std::swap(__stats_splits, other.__stats_splits);
+        std::swap(__stats_merges, other.__stats_merges);
+#endif
+        if (mine_prev == nullptr && theirs_prev == nullptr) return;
+        __exchange_inline(other, __has_embedded());
+        std::swap(__inline_used, other.__inline_used);
+        if (theirs_prev != nullptr) __link_after(theirs_prev == other.head ? head : theirs_prev, __inline_bucket());
+        if (mine_prev != nullptr)
+            other.__link_after(mine_prev == head ? other.head : mine_prev, other.__inline_bucket());
+    }
+
+  public:
+    /**
+     * @brief   Access the element at specified index
+     *
+     * @throw   index_out_of_bound  if the index is out of bound
+     */
+    T &at(const size_t &pos) {
+        return operator[](pos);
+    }
+    const T &at(const size_t &pos) const {
+        return operator[](pos);
+    }
+
+    /**
+     * The same as @code{at}
+     *
+     * Accessing an element near the previously accessed one through a non-const container takes amortized O(1)
+     * time, so that looping over indices in order is as cheap as iterating. The const overload always takes
+     * O(log n) time, as it does not move the cursor of the last access.
+     */
+    T &operator[](const size_t &pos) {
+        if (pos >= __size) throw index_out_of_bound();
+        size_t index = pos;
+        bucket *tar_bucket = __access(index);
+        tar_bucket->__unshare();
+        return (*tar_bucket)[index];
+    }
+    const T &operator[](const size_t &pos) const {
+        if (pos >= __size) throw index_out_of_bound();
+        size_t index = pos;
+        bucket *tar_bucket = __locate(index);
+        return (*tar_bucket)[index];
+    }
+
+    /**
+     * @brief   Access the first element
+     *
+     * @throw   container_is_empty  if the container is empty.
+     */
+    const T &front() const {
+        if (__size == 0) throw container_is_empty();
+        return (*head->next)[0];
+    }
+
+    /**
+     * @brief   Access the last element
+     *
+     * @throw   container_is_empty  if the container is empty.
+     */
+    const T &back() const {
+        if (__size == 0) throw container_is_empty();
+        return (*tail->prev)[tail->prev->size - 1];
+    }
+
+    /**
+     * @return  A @code{iterator} pointing to the first element
+     */
+    iterator begin() {
+        return iterator(this, head->next, 0);
+    }
+
+    /**
+     * @return  A @code{const_iterator} pointing to the first element
+     */
+    const_iterator cbegin() const {
+        return const_iterator(this, head->next, 0);
+    }
+
+    /**
+     * @return  A @code{iterator} pointing to the next of the last element
+     */
+    iterator end() {
+        return iterator(this, tail, 0);
+    }
+
+    /**
+     * @return  A @code{const_iterator} pointing to the next of the last element
+     */
+    const_iterator cend() const {
+        return const_iterator(this, tail, 0);
+    }
+
+    /**
+     * @brief   Check whether the container is empty
+     */
+    bool empty() const {
+        return __size == 0;
+    }
+
+    /**
+     * @return  The number of elements
+     */
+    size_t size() const {
+        return __size;
+    }
+
+    /**
+     * @brief   Set the maximum number of bytes kept by buckets which are drained but kept for reuse
+     *
+     * Emptied buckets are recycled by later pushes at either side instead of returning to the heap. Setting the
+     * limit to 0 disables recycling.
+     */
+    void set_pool_limit(size_t bytes) {
+        __pool_limit = bytes;
+        __trim_pool(bytes);
+    }
+
+    /**
+     * @brief   Re-pack all elements into buckets of the size which new buckets are filled to, in one linear pass
+     *
+     * Only a bucket or two is allocated at a time, since drained buckets are recycled through the pool. When
+     * spilling, each filled bucket in the middle is spilled at once, so compacting never reads all spilled buckets
+     * into memory together. All iterators are invalidated.
+     */
+    void compact() {
+        size_t fill = __fill_size();
+        bucket *first_bucket = nullptr, *last_bucket = nullptr;
+        for (auto cur = head->next; cur != tail;) {
+            auto next_bucket = cur->next;
+            cur->__unshare();
+            for (size_t i = 0; i < cur->size;) {
+                if (last_bucket == nullptr || last_bucket->size == fill) {
+                    if (last_bucket != first_bucket) __spill_filled(last_bucket);
+                    auto new_bucket = __acquire_bucket(bucket::__round_up(fill));
+                    if (last_bucket == nullptr) first_bucket = new_bucket;
+                    else last_bucket->next = new_bucket;
+                    new_bucket->prev = last_bucket;
+                    last_bucket = new_bucket;
+                }
+                size_t count = fill - last_bucket->size < cur->size - i ? fill - last_bucket->size : cur->size - i;
+                if (cur->anchors != nullptr) cur->__move_anchors(i, i + count, last_bucket, last_bucket->size);
+                last_bucket->__relocate_from(cur, i, last_bucket->size, count);
+                last_bucket->size += count;
+                i += count;
+            }
+            cur->start = cur->size = 0;
+            __release_bucket(cur);
+            cur = next_bucket;
+        }
+        if (first_bucket == nullptr) return;
+        head->next = first_bucket;
+        first_bucket->prev = head;
+        last_bucket->next = tail;
+        tail->prev = last_bucket;
+        __index_dirty = true;
+        __epoch++;
+        if (__spill != nullptr) __spill_cold();
+    }
+
+    /**
+     * @brief   Re-pack all elements like @code{compact()}, and then free the memory kept for reuse
+     */
+    void shrink_to_fit() {
+        compact();
+        __trim_pool(0);
+        delete[] __index_bucket;
+        delete[] __index_tree;
+        __index_bucket = nullptr;
+        __index_tree = nullptr;
+        __index_capacity = __index_count = 0;
+        __index_dirty = true;
+    }
+
+    /**
+     * @brief   Compact automatically after removing in the middle, once the elements fill less than @code{ratio}
+     *          of the buckets, measured against the size which new buckets are filled to
+     *
+     * It is disabled by default, or when @code{ratio} is not positive. Checking takes O(sqrt n) time only after
+     * buckets have been merged or removed.
+     */
+    void set_compact_threshold(double ratio) {
+        __compact_threshold = ratio;
+    }
+
+  private:
+    double __compact_threshold = 0;
 
     /**
-     * @brief   Copy constructor
+     * @return  Whether the elements fill less than @code{__compact_threshold} of the buckets
      */
-    deque(const deque &other) : head(new bucket), tail(new bucket), __size(other.__size) {
-        head->next = tail;
-        tail->prev = head;
-
-        for (auto old_bucket = other.head->next; old_bucket != other.tail; old_bucket = old_bucket->next) {
-            auto new_bucket = bucket::__copy_bucket(old_bucket);
-            tail->prev->next = new_bucket;
-            new_bucket->prev = tail->prev;
-            tail->prev = new_bucket;
-            new_bucket->next = tail;
-        }
+    bool __sparse() const {
+        if (__compact_threshold <= 0 || __size == 0 || head->next->next == tail) return false;
+        if (__index_dirty) __index_rebuild();
+        return __index_count > 1 &&
+               static_cast<double>(__size) < __compact_threshold * __index_count * Policy::fill(__size);
     }
 
     /**
-     * @brief   Destructor
+     * @brief   Compact if the container is sparse after removing
+     *
+     * @return  An iterator pointing to the same element as @code{pos}
      */
-    ~deque() {
-        clear();
-        delete head->head;
-        delete head->tail;
-        delete head;
-        delete tail->head;
-        delete tail->tail;
-        delete tail;
+    iterator __compact_if_sparse(iterator pos) {
+        if (!__sparse()) return pos;
+        size_t offset = pos.pos();
+        compact();
+        auto tar_bucket = __locate(offset);
+        return iterator(this, tar_bucket, offset);
     }
 
+  public:
     /**
-     * @brief   Assignment operator
+     * @brief   Keep about @code{budget} bytes of buckets in memory, writing the other buckets in the middle into the
+     *          file at @code{path}, and reading them back when they are accessed
+     *
+     * Only available when @code{T} is trivially copyable. The file is created or truncated, and removed once it is
+     * no longer used, or right after it is created on POSIX systems. The buckets nearest to either end are kept in
+     * memory, and popping at the front advises the system to read the next spilled bucket ahead. Buckets are spilled
+     * only while elements are added, so accessing never spills, and iterators stay valid, though pointers and
+     * references to elements may not. Containers which receive spilled buckets by splicing or splitting read them
+     * from the same file, and MUST NOT be accessed concurrently. Taking a snapshot reads all spilled buckets back,
+     * since their storages are shared. Buckets which cannot be written to the file are kept in memory.
+     *
+     * @throw   runtime_error   if the file cannot be created
      */
-    deque &operator=(const deque &other) {
-        if (this == &other) return *this;
-        clear();
-        __size = other.__size;
-        for (auto old_bucket = other.head->next; old_bucket != other.tail; old_bucket = old_bucket->next) {
-            auto new_bucket = bucket::__copy_bucket(old_bucket);
-            tail->prev->next = new_bucket;
-            new_bucket->prev = tail->prev;
-            tail->prev = new_bucket;
-            new_bucket->next = tail;
-        }
-        return *this;
+    void enable_spill(const char *path, size_t budget) {
+        static_assert(std::is_trivially_copyable<T>::value, "spilling requires trivially copyable elements");
+        auto new_spill = __spill_file::__open(path);
+        if (__spill != nullptr) __spill_file::__release(__spill);
+        __spill = new_spill;
+        __spill_budget = budget;
+        __trim_pool(__pool_cap());
+        __spill_cold();
     }
 
-  public:
     /**
-     * @brief   Access the element at specified index
+     * @brief   Read all spilled buckets back into memory, and stop spilling
      *
-     * @throw   index_out_of_bound  if the index is out of bound
+     * @throw   runtime_error   if the file cannot be read
      */
-    T &at(const size_t &pos) {
-        // if (pos < 0 || pos >= __size) throw index_out_of_bound();
-        return operator[](pos);
-    }
-    const T &at(const size_t &pos) const {
-        // if (pos < 0 || pos >= __size) throw index_out_of_bound();
-        return operator[](pos);
+    void disable_spill() {
+        for (auto cur = head->next; cur != tail; cur = cur->next)
+            if (cur->spill != nullptr) cur->__fault();
+        if (__spill != nullptr) __spill_file::__release(__spill);
+        __spill = nullptr;
     }
 
+  private:
+    __spill_file *__spill = nullptr;
+    size_t __spill_budget = 0;
+    size_t __spill_countdown = 0;
+
     /**
-     * The same as @code{at}
+     * @brief   Spill the buckets in the middle which do not fit in the budget, keeping the buckets nearest to either
+     *          end in memory, alternately from the front and the back
+     *
+     * It walks all buckets, so it is done again only after as many elements as buckets have been added. It runs
+     * after elements have been added, so a bucket which cannot be written is kept in memory rather than failing an
+     * insertion which has already taken place.
      */
-    T &operator[](const size_t &pos) {
-        if (pos < 0 || pos >= __size) throw index_out_of_bound();
-        bucket *cur_bucket = head->next;
-        size_t cur_pos = 0;
-        while (cur_pos + cur_bucket->size <= pos) {
-            cur_pos += cur_bucket->size;
-            cur_bucket = cur_bucket->next;
+    void __spill_cold() {
+        size_t used = 0, count = 0;
+        bucket *first = head->next, *last = tail->prev;
+        for (bool front = true; first != last->next; front = !front) {
+            bucket *cur = front ? first : last;
+            size_t bytes = cur->spill != nullptr || cur == __inline_bucket() ? 0 : __bucket_bytes(cur);
+            // the first and the last buckets are always kept
+            if (used + bytes > __spill_budget && cur != head->next && cur != tail->prev) break;
+            used += bytes;
+            count++;
+            if (front) first = first->next;
+            else last = last->prev;
         }
-        node *cur_node = cur_bucket->head->next;
-        while (cur_pos < pos) {
-            cur_pos++;
-            cur_node = cur_node->next;
+        for (auto cur = first; cur != last->next; cur = cur->next) {
+            count++;
+            if (cur->spill == nullptr && cur != __inline_bucket() && cur->storage->source == nullptr)
+                cur->__try_spill_to(__spill);
         }
-        return *(cur_node->value);
+        __spill_countdown = count + 1;
     }
-    const T &operator[](const size_t &pos) const {
-        if (pos < 0 || pos >= __size) throw index_out_of_bound();
-        bucket *cur_bucket = head->next;
-        size_t cur_pos = 0;
-        while (cur_pos + cur_bucket->size <= pos) {
-            cur_pos += cur_bucket->size;
-            cur_bucket = cur_bucket->next;
-        }
-        node *cur_node = cur_bucket->head->next;
-        while (cur_pos < pos) {
-            cur_pos++;
-            cur_node = cur_node->next;
+
+    /**
+     * @brief   Spill a bucket in the middle just filled by re-packing, unless spilling is disabled
+     */
+    void __spill_filled(bucket *tar_bucket) {
+        if (__spill != nullptr && tar_bucket != __inline_bucket()) tar_bucket->__try_spill_to(__spill);
+    }
+
+    /**
+     * @brief   Record that @code{count} elements have been added, spilling buckets if it is time to check
+     */
+    void __spill_tick(size_t count) {
+        if (__spill == nullptr) return;
+        if (__spill_countdown > count) {
+            __spill_countdown -= count;
+            return;
         }
-        return *(cur_node->value);
+        __spill_cold();
     }
 
     /**
-     * @brief   Access the first element
-     *
-     * @throw   container_is_empty  if the container is empty.
+     * @brief   Advise reading the second bucket ahead if it is spilled, once the first one is drained to a quarter
      */
-    const T &front() const {
-        if (__size == 0) throw container_is_empty();
-        return *(head->next->head->next->value);
+    void __prefetch_front() {
+        bucket *first = head->next;
+        if (first == tail || first->next == tail) return;
+        bucket *next_bucket = first->next;
+        if (next_bucket->spill == nullptr || first->size > (first->capacity >> 2)) return;
+        if (next_bucket->spill->prefetched == next_bucket->spill_offset) return;
+        next_bucket->spill->__prefetch(next_bucket->spill_offset, next_bucket->size);
     }
 
+  public:
     /**
-     * @brief   Access the last element
-     *
-     * @throw   container_is_empty  if the container is empty.
+     * @brief   Report the memory usage and the layout of buckets, which takes O(sqrt n) time
      */
-    const T &back() const {
-        if (__size == 0) throw container_is_empty();
-        return *(tail->prev->tail->prev->value);
+    deque_stats stats() const {
+        deque_stats result = {};
+        result.size = __size;
+        result.bytes = __index_capacity * (sizeof(bucket *) + sizeof(size_t));
+        if (__index_tree != nullptr) result.bytes += sizeof(size_t);
+        for (auto cur = head->next; cur != tail; cur = cur->next) {
+            if (result.bucket_count == 0 || cur->size < result.min_occupancy) result.min_occupancy = cur->size;
+            if (cur->size > result.max_occupancy) result.max_occupancy = cur->size;
+            result.bucket_count++;
+            result.slots += cur->capacity;
+            size_t bin = 0;
+            while (bin + 1 < deque_stats::HISTOGRAM_BINS && (cur->size >> (bin + 1)) > 0) bin++;
+            result.histogram[bin]++;
+            if (cur != __inline_bucket()) result.bytes += sizeof(bucket);
+            if (cur->spill != nullptr) result.spilled_buckets++;
+            else if (cur->storage->source == nullptr && !cur->storage->embedded)
+                result.bytes += block::__header_size() + cur->capacity * sizeof(T);
+        }
+        if (result.bucket_count > 0) result.avg_occupancy = static_cast<double>(__size) / result.bucket_count;
+        for (auto cur = __pool; cur != nullptr; cur = cur->next)
+            result.pool_bytes += sizeof(bucket) + block::__header_size() + cur->capacity * sizeof(T);
+        result.bytes += result.pool_bytes;
+        if (__spill != nullptr) {
+            result.spills = __spill->spills;
+            result.faults = __spill->faults;
+            result.prefetches = __spill->prefetches;
+        }
+#ifdef SJTU_DEQUE_STATS
+        result.splits = __stats_splits;
+        result.merges = __stats_merges;
+#endif
+        return result;
     }
 
     /**
-     * @return  A @code{iterator} pointing to the first element
+     * @brief   Call @code{f(T *first, size_t count)} on each contiguous segment of elements in order
+     *
+     * Each bucket provides one segment, or two if its ring array wraps around, so that the inner loop over a
+     * segment is a plain loop over an array, which can be vectorized. The elements may be modified through the
+     * pointers, but the container MUST NOT be modified inside @code{f}. When spilling, the const overload reads
+     * spilled buckets into a temporary array one at a time, which stay spilled.
      */
-    iterator begin() {
-        return iterator(this, head->next, head->next->head->next);
+    template <typename Function>
+    void for_each_segment(Function f) {
+        for (auto cur = head->next; cur != tail; cur = cur->next) {
+            cur->__unshare();
+            cur->template __for_each_span<T *>(f);
+        }
     }
 
     /**
-     * @return  A @code{const_iterator} pointing to the first element
+     * @brief   Call @code{f(const T *first, size_t count)} on each contiguous segment of elements in order
      */
-    const_iterator cbegin() const {
-        return const_iterator(this, head->next, head->next->head->next);
+    template <typename Function>
+    void for_each_segment(Function f) const {
+        for (auto cur = head->next; cur != tail; cur = cur->next)
+            cur->template __for_each_span<const T *>(f);
     }
 
+  private:
     /**
-     * @return  A @code{iterator} pointing to the next of the last element
+     * @brief   Find the first element not satisfying @code{pred}, where elements satisfying @code{pred} MUST
+     *          precede the others
+     *
+     * It binary-searches the last elements of buckets through the index, and then the elements of the found bucket,
+     * which takes O(log n) time.
+     *
+     * @return  The bucket of the found element, and @code{index} is set to its index inside the bucket
      */
-    iterator end() {
-        return iterator(this, tail, tail->head->next);
+    template <typename Predicate>
+    bucket *__partition_point(Predicate pred, size_t &index) const {
+        if (__index_dirty) __index_rebuild();
+        size_t low = 0, high = __index_count;
+        while (low < high) {
+            size_t mid = (low + high) >> 1;
+            const bucket *cur = __index_bucket[mid];
+            if (pred((*cur)[cur->size - 1])) low = mid + 1;
+            else high = mid;
+        }
+        index = 0;
+        if (low == __index_count) return tail;
+        bucket *result = __index_bucket[low];
+        high = result->size - 1;
+        while (index < high) {
+            size_t mid = (index + high) >> 1;
+            if (pred((*result)[mid])) index = mid + 1;
+            else high = mid;
+        }
+        return result;
     }
 
+  public:
     /**
-     * @return  A @code{const_iterator} pointing to the next of the last element
+     * @brief   Find the first element which is not less than @code{value} in a container sorted by @code{cmp},
+     *          which takes O(log n) time
+     *
+     * @return  An iterator pointing to the found element, or @code{end()} if there is no such element
      */
-    const_iterator cend() const {
-        return const_iterator(this, tail, tail->head->next);
+    template <typename Compare>
+    iterator lower_bound(const T &value, Compare cmp) {
+        size_t index;
+        bucket *result = __partition_point([&](const T &element) { return cmp(element, value); }, index);
+        return iterator(this, result, index);
+    }
+    template <typename Compare>
+    const_iterator lower_bound(const T &value, Compare cmp) const {
+        size_t index;
+        bucket *result = __partition_point([&](const T &element) { return cmp(element, value); }, index);
+        return const_iterator(this, result, index);
+    }
+    iterator lower_bound(const T &value) {
+        return lower_bound(value, std::less<T>());
+    }
+    const_iterator lower_bound(const T &value) const {
+        return lower_bound(value, std::less<T>());
     }
 
     /**
-     * @brief   Check whether the container is empty
+     * @brief   Find the first element which is greater than @code{value} in a container sorted by @code{cmp},
+     *          which takes O(log n) time
+     *
+     * @return  An iterator pointing to the found element, or @code{end()} if there is no such element
      */
-    bool empty() const {
-        return __size == 0;
+    template <typename Compare>
+    iterator upper_bound(const T &value, Compare cmp) {
+        size_t index;
+        bucket *result = __partition_point([&](const T &element) { return !cmp(value, element); }, index);
+        return iterator(this, result, index);
+    }
+    template <typename Compare>
+    const_iterator upper_bound(const T &value, Compare cmp) const {
+        size_t index;
+        bucket *result = __partition_point([&](const T &element) { return !cmp(value, element); }, index);
+        return const_iterator(this, result, index);
+    }
+    iterator upper_bound(const T &value) {
+        return upper_bound(value, std::less<T>());
+    }
+    const_iterator upper_bound(const T &value) const {
+        return upper_bound(value, std::less<T>());
     }
 
     /**
-     * @return  The number of elements
+     * @brief   Find the range of elements equivalent to @code{value} in a container sorted by @code{cmp}, which
+     *          takes O(log n) time
+     *
+     * @return  The pair of @code{lower_bound} and @code{upper_bound}
      */
-    size_t size() const {
-        return __size;
+    template <typename Compare>
+    pair<iterator, iterator> equal_range(const T &value, Compare cmp) {
+        return pair<iterator, iterator>(lower_bound(value, cmp), upper_bound(value, cmp));
+    }
+    template <typename Compare>
+    pair<const_iterator, const_iterator> equal_range(const T &value, Compare cmp) const {
+        return pair<const_iterator, const_iterator>(lower_bound(value, cmp), upper_bound(value, cmp));
+    }
+    pair<iterator, iterator> equal_range(const T &value) {
+        return equal_range(value, std::less<T>());
+    }
+    pair<const_iterator, const_iterator> equal_range(const T &value) const {
+        return equal_range(value, std::less<T>());
     }
 
     /**
@@ -345,15 +2569,13 @@ class deque {
         bucket *cur = head->next;
         while (cur != tail) {
             bucket *next_bucket = cur->next;
-            cur->clear();
-            delete cur->head;
-            delete cur->tail;
-            delete cur;
+            __release_bucket(cur);
             cur = next_bucket;
         }
         head->next = tail;
         tail->prev = head;
         __size = 0;
+        __index_dirty = true;
     }
 
     /**
@@ -363,27 +2585,78 @@ class deque {
      * @throw   invalid_iterator    if the iterator points to another container
      */
     iterator insert(iterator pos, const T &value) {
+        return emplace(pos, value);
+    }
+    iterator insert(iterator pos, T &&value) {
+        return emplace(pos, std::move(value));
+    }
+
+    /**
+     * @brief   Insert @code{count} copies of @code{value} before @code{pos}
+     *
+     * @return  An iterator pointing to the first inserted value, or @code{pos} if @code{count} is 0
+     * @throw   invalid_iterator    if the iterator points to another container
+     */
+    iterator insert(iterator pos, size_t count, const T &value) {
+        // copy first, since splitting the bucket may move the element referred by value
+        T copy(value);
+        return __insert_range(pos, __repeat_iterator{&copy, count}, __repeat_iterator{&copy, 0});
+    }
+
+    /**
+     * @brief   Insert elements in [first, last) before @code{pos}, which MUST NOT point to this container
+     *
+     * @return  An iterator pointing to the first inserted value, or @code{pos} if the range is empty
+     * @throw   invalid_iterator    if the iterator points to another container
+     */
+    template <typename InputIterator,
+              typename = typename std::enable_if<!std::is_integral<InputIterator>::value>::type>
+    iterator insert(iterator pos, InputIterator first, InputIterator last) {
+        return __insert_range(pos, first, last);
+    }
+
+    /**
+     * @brief   Construct an element in-place at the specified location(before @code{pos}) in the container.
+     *
+     * @return  An iterator pointing to the inserted value
+     * @throw   invalid_iterator    if the iterator points to another container
+     */
+    template <typename... Args>
+    iterator emplace(iterator pos, Args &&... args) {
         if (pos.__deque != this) throw invalid_iterator();
         if (pos == end()) {
-            push_back(value);
+            emplace_back(std::forward<Args>(args)...);
             return --end();
         }
-        __size++;
+        // construct before moving elements, since the arguments may refer to elements in this container
+        T value(std::forward<Args>(args)...);
         bucket *tar_bucket = pos.__bucket;
-        tar_bucket->size++;
-        node *pos_node = pos.__node;
-        auto new_node = new node;
-        new_node->value = new T(value);
-        new_node->prev = pos_node->prev;
-        pos_node->prev->next = new_node;
-        new_node->next = pos_node;
-        pos_node->prev = new_node;
-        if (tar_bucket->size > SPLIT_PARA())
-            tar_bucket->__split_before(tar_bucket->size >> 1);
-        for (auto i = tar_bucket->head->next; i != tar_bucket->tail; i = i->next)
-            if (i == new_node)
-                return iterator(this, tar_bucket, new_node);
-        return iterator(this, tar_bucket->next, new_node);
+        size_t index = pos.__index;
+        if (tar_bucket->full()) {
+            if (tar_bucket->size >= SPLIT_PARA()) {
+                // split before inserting instead of growing a bucket which would be split right after
+                __split(tar_bucket, tar_bucket->size >> 1);
+                __index_dirty = true;
+                if (index > tar_bucket->size) {
+                    index -= tar_bucket->size;
+                    tar_bucket = tar_bucket->next;
+                }
+            } else {
+                tar_bucket->__reserve(tar_bucket->capacity << 1);
+            }
+        }
+        tar_bucket->insert(index, std::move(value));
+        __size++;
+        __epoch++;
+        __index_add(tar_bucket, 1);
+        if (__oversized(tar_bucket)) {
+            __split(tar_bucket, tar_bucket->size >> 1);
+            __index_dirty = true;
+        }
+        __spill_tick(1);
+        if (index < tar_bucket->size)
+            return iterator(this, tar_bucket, index);
+        return iterator(this, tar_bucket->next, index - tar_bucket->size);
     }
 
     /**
@@ -396,68 +2669,290 @@ class deque {
         if (pos.__deque != this) throw invalid_iterator();
         *pos; // test whether pos is invalid
         __size--;
+        __epoch++;
         bucket *tar_bucket = pos.__bucket;
-        tar_bucket->size--;
-        node *tar_node = pos.__node;
+        size_t index = pos.__index;
+        tar_bucket->erase(index);
+        __index_add(tar_bucket, -1);
         if (tar_bucket->size == 0) {
-            iterator next_iterator(this, tar_bucket->next, tar_bucket->next->head->next);
-            tar_bucket->clear();
-            delete tar_bucket->head;
-            delete tar_bucket->tail;
-            tar_bucket->next->prev = tar_bucket->prev;
-            tar_bucket->prev->next = tar_bucket->next;
-            delete tar_bucket;
-            return next_iterator;
+            iterator next_iterator(this, tar_bucket->next, 0);
+            __remove_bucket(tar_bucket);
+            return __compact_if_sparse(next_iterator);
         }
-        bool next_in_next_bucket = tar_node->next == tar_bucket->tail;
-        node *next_node = next_in_next_bucket ? tar_bucket->next->head->next : tar_node->next;
-        tar_node->next->prev = tar_node->prev;
-        tar_node->prev->next = tar_node->next;
-        delete tar_node;
         if (tar_bucket->prev != head && tar_bucket->size + tar_bucket->prev->size < MERGE_PARA()) {
             bucket *result_bucket = tar_bucket->prev;
-            result_bucket->__merge_next();
-            if (next_in_next_bucket)
-                return iterator(this, result_bucket->next, next_node);
-            else
-                return iterator(this, result_bucket, next_node);
+            index += result_bucket->size;
+            __merge(result_bucket);
+            tar_bucket = result_bucket;
+            __index_dirty = true;
         } else if (tar_bucket->next != tail && tar_bucket->size + tar_bucket->next->size < MERGE_PARA()) {
-            tar_bucket->__merge_next();
-            return iterator(this, tar_bucket, next_node);
+            __merge(tar_bucket);
+            __index_dirty = true;
+        }
+        if (index < tar_bucket->size)
+            return __compact_if_sparse(iterator(this, tar_bucket, index));
+        return __compact_if_sparse(iterator(this, tar_bucket->next, 0));
+    }
+
+    /**
+     * @brief   Remove elements in [first, last)
+     *
+     * Buckets covered by the range are released as a whole, and only the buckets at both ends of the range are
+     * trimmed and rebalanced.
+     *
+     * @return  An iterator pointing to the element which @code{last} pointed to
+     * @throw   invalid_iterator    if an iterator points to another container, or @code{last} is before @code{first}
+     */
+    iterator erase(iterator first, iterator last) {
+        if (first.__deque != this || last.__deque != this) throw invalid_iterator();
+        size_t offset = first.pos();
+        if (last.pos() < offset) throw invalid_iterator();
+        size_t count = last.pos() - offset;
+        if (count == 0) return last;
+        bucket *first_bucket = first.__bucket, *last_bucket = last.__bucket;
+        if (first_bucket == last_bucket) {
+            first_bucket->erase(first.__index, count);
+        } else {
+            first_bucket->erase(first.__index, first_bucket->size - first.__index);
+            for (auto cur = first_bucket->next; cur != last_bucket;) {
+                auto next_bucket = cur->next;
+                __remove_bucket(cur);
+                cur = next_bucket;
+            }
+            if (last.__index > 0) last_bucket->erase(0, last.__index);
+        }
+        __size -= count;
+        __epoch++;
+        __index_dirty = true;
+        if (first_bucket->size == 0) {
+            last_bucket = first_bucket->next;
+            __remove_bucket(first_bucket);
+            __rebalance(last_bucket);
+        } else {
+            __rebalance(first_bucket);
+        }
+        if (__sparse()) compact();
+        auto tar_bucket = __locate(offset);
+        return iterator(this, tar_bucket, offset);
+    }
+
+    /**
+     * @brief   Move all elements of @code{other} before @code{pos}, leaving @code{other} empty
+     *
+     * The buckets of @code{other} are relinked rather than copied, so it takes O(sqrt n) time: the bucket of
+     * @code{pos} is split at most once, and only the buckets at both seams are rebalanced.
+     *
+     * @throw   invalid_iterator    if the iterator points to another container
+     */
+    void splice(iterator pos, deque &other) {
+        if (pos.__deque != this) throw invalid_iterator();
+        if (&other == this || other.__size == 0) return;
+        if (other.__inline_used) other.__evict_inline(__has_embedded());
+        bucket *prev_bucket, *next_bucket;
+        if (pos.__index == 0) {
+            next_bucket = pos.__bucket;
+            prev_bucket = next_bucket->prev;
+        } else {
+            prev_bucket = pos.__bucket;
+            __split(prev_bucket, pos.__index);
+            next_bucket = prev_bucket->next;
+        }
+        bucket *first_bucket = other.head->next, *last_bucket = other.tail->prev;
+        other.head->next = other.tail;
+        other.tail->prev = other.head;
+        prev_bucket->next = first_bucket;
+        first_bucket->prev = prev_bucket;
+        last_bucket->next = next_bucket;
+        next_bucket->prev = last_bucket;
+
+        __size += other.__size;
+        other.__size = 0;
+        other.__index_dirty = true;
+        // the cached offsets of buckets from other MUST NOT be treated as valid
+        __epoch = (__epoch > other.__epoch ? __epoch : other.__epoch) + 1;
+        __index_dirty = true;
+
+        if (next_bucket != tail && last_bucket->size + next_bucket->size < MERGE_PARA())
+            __merge(last_bucket);
+        if (prev_bucket != head && prev_bucket->size + first_bucket->size < MERGE_PARA())
+            __merge(prev_bucket);
+    }
+
+    /**
+     * @brief   Move all elements of @code{other} to the end, leaving @code{other} empty
+     */
+    void splice(deque &other) {
+        splice(end(), other);
+    }
+
+    /**
+     * @brief   The same as @code{splice(other)}
+     */
+    deque &append(deque &&other) {
+        splice(end(), other);
+        return *this;
+    }
+
+    /**
+     * @brief   Move elements from @code{pos} to the end into a new container
+     *
+     * The buckets are relinked rather than copied, so it takes O(sqrt n) time. Iterators pointing to the moved
+     * elements are invalidated.
+     *
+     * @return  A container containing elements in [pos, end()), which are removed from this container
+     * @throw   invalid_iterator    if the iterator points to another container
+     */
+    deque split(iterator pos) {
+        if (pos.__deque != this) throw invalid_iterator();
+        deque result;
+        size_t offset = pos.pos();
+        if (offset == __size) return result;
+        bucket *first_bucket;
+        if (pos.__index == 0) {
+            first_bucket = pos.__bucket;
         } else {
-            if (next_in_next_bucket)
-                return iterator(this, tar_bucket->next, next_node);
-            else
-                return iterator(this, tar_bucket, next_node);
+            __split(pos.__bucket, pos.__index);
+            first_bucket = pos.__bucket->next;
+        }
+        for (auto cur = first_bucket; __inline_used && cur != tail; cur = cur->next) {
+            if (cur != __inline_bucket()) continue;
+            cur = __evict_inline(__has_embedded());
+            if (first_bucket == __inline_bucket()) first_bucket = cur;
+            break;
+        }
+        bucket *prev_bucket = first_bucket->prev, *last_bucket = tail->prev;
+        prev_bucket->next = tail;
+        tail->prev = prev_bucket;
+        result.head->next = first_bucket;
+        first_bucket->prev = result.head;
+        last_bucket->next = result.tail;
+        result.tail->prev = last_bucket;
+
+        result.__size = __size - offset;
+        __size = offset;
+        // the cached offsets of moved buckets MUST NOT be treated as valid
+        result.__epoch = __epoch + 1;
+        __index_dirty = true;
+
+        __rebalance(prev_bucket);
+        result.__rebalance(first_bucket);
+        return result;
+    }
+
+    /**
+     * @brief   Get a handle to the element at @code{pos} in O(1) time
+     *
+     * @throw   invalid_iterator    if the iterator points to another container or to the end
+     */
+    handle handle_of(const iterator &pos) {
+        if (pos.__deque != this || pos.__bucket == nullptr || pos.__bucket == tail) throw invalid_iterator();
+        auto new_anchor = new __anchor;
+        new_anchor->ref = 1;
+        new_anchor->index = pos.__index;
+        pos.__bucket->__link_anchor(new_anchor);
+        return handle(new_anchor);
+    }
+
+    /**
+     * @return  An iterator pointing to the element referred to by @code{target}, which MUST be in this container,
+     *          in O(1) time
+     * @throw   invalid_iterator    if the element has been removed
+     */
+    iterator iterator_of(const handle &target) {
+        if (!target.valid()) throw invalid_iterator();
+        return iterator(this, target.__target->owner, target.__target->index);
+    }
+    const_iterator iterator_of(const handle &target) const {
+        if (!target.valid()) throw invalid_iterator();
+        return const_iterator(this, target.__target->owner, target.__target->index);
+    }
+
+    /**
+     * @brief   Rotate the elements to the left, so that the @code{k}-th element becomes the first
+     *
+     * The buckets are relinked rather than moved, so it takes O(sqrt n) time. All iterators are invalidated.
+     *
+     * @throw   index_out_of_bound  if @code{k} exceeds the size
+     */
+    void rotate(size_t k) {
+        if (k > __size) throw index_out_of_bound();
+        if (k == 0 || k == __size) return;
+        size_t index = k;
+        bucket *new_first = __locate(index);
+        if (index != 0) {
+            __split(new_first, index);
+            new_first = new_first->next;
+        }
+        bucket *old_first = head->next, *old_last = tail->prev, *new_last = new_first->prev;
+        new_last->next = tail;
+        tail->prev = new_last;
+        head->next = new_first;
+        new_first->prev = head;
+        old_last->next = old_first;
+        old_first->prev = old_last;
+        __index_dirty = true;
+        __epoch++;
+
+        if (old_last->size + old_first->size < MERGE_PARA())
+            __merge(old_last);
+    }
+
+    /**
+     * @brief   Reverse the order of elements
+     *
+     * Only the list of buckets is reversed, and each bucket is marked reversed, so it takes O(sqrt n) time. A
+     * reversed bucket is read backwards, and reversed in place only when elements are inserted or erased in the
+     * middle of it. All iterators are invalidated.
+     */
+    void reverse() {
+        if (__size == 0) return;
+        bucket *first_bucket = head->next, *last_bucket = tail->prev;
+        for (auto cur = first_bucket; cur != tail;) {
+            bucket *next_bucket = cur->next;
+            std::swap(cur->prev, cur->next);
+            cur->reversed = !cur->reversed;
+            for (__anchor *anchor = cur->anchors; anchor != nullptr; anchor = anchor->next)
+                anchor->index = cur->size - 1 - anchor->index;
+            cur = next_bucket;
         }
+        head->next = last_bucket;
+        last_bucket->prev = head;
+        tail->prev = first_bucket;
+        first_bucket->next = tail;
+        __index_dirty = true;
+        __epoch++;
     }
 
     /**
      * @brief   Add an element to the end
      */
     void push_back(const T &value) {
-        __size++;
-        if (__size == 1 || tail->prev->size > NEW_PARA()) {
-            auto new_bucket = new bucket;
-            auto new_node = new node;
-            new_node->value = new T(value);
-            new_bucket->head->next = new_bucket->tail->prev = new_node;
-            new_node->prev = new_bucket->head;
-            new_node->next = new_bucket->tail;
-            tail->prev->next = new_bucket;
-            new_bucket->prev = tail->prev;
-            new_bucket->next = tail;
-            tail->prev = new_bucket;
-            new_bucket->size = 1;
+        emplace_back(value);
+    }
+    void push_back(T &&value) {
+        emplace_back(std::move(value));
+    }
+
+    /**
+     * @brief   Construct an element in-place at the end
+     */
+    template <typename... Args>
+    void emplace_back(Args &&... args) {
+        if (tail->prev == head || __saturated(tail->prev)) {
+            auto new_bucket = __acquire_end_bucket();
+            try {
+                new_bucket->emplace_back(std::forward<Args>(args)...);
+            } catch (...) {
+                __release_bucket(new_bucket);
+                throw;
+            }
+            __link_after(tail->prev, new_bucket);
         } else {
-            tail->prev->size++;
-            auto new_node = new node;
-            new_node->value = new T(value);
-            tail->prev->tail->prev->next = new_node;
-            new_node->prev = tail->prev->tail->prev;
-            new_node->next = tail->prev->tail;
-            tail->prev->tail->prev = new_node;
+            tail->prev->emplace_back(std::forward<Args>(args)...);
+            __index_add(tail->prev, 1);
         }
+        __size++;
+        __spill_tick(1);
     }
 
     /**
@@ -468,49 +2963,44 @@ class deque {
     void pop_back() {
         if (__size == 0) throw container_is_empty();
         __size--;
-        tail->prev->size--;
-        if (tail->prev->size == 0) {
-            auto tar_bucket = tail->prev;
-            delete tar_bucket->head->next;
-            delete tar_bucket->head;
-            delete tar_bucket->tail;
-            tar_bucket->prev->next = tar_bucket->next;
-            tar_bucket->next->prev = tar_bucket->prev;
-            delete tar_bucket;
-        } else {
-            auto tar_node = tail->prev->tail->prev;
-            tar_node->prev->next = tar_node->next;
-            tar_node->next->prev = tar_node->prev;
-            delete tar_node;
-        }
+        tail->prev->pop_back();
+        __index_add(tail->prev, -1);
+        if (tail->prev->size == 0)
+            __remove_bucket(tail->prev);
     }
 
     /**
      * @brief   Add an element to the beginning
      */
     void push_front(const T &value) {
-        __size++;
-        if (__size == 1 || head->next->size > NEW_PARA()) {
-            auto new_bucket = new bucket;
-            auto new_node = new node;
-            new_node->value = new T(value);
-            new_bucket->head->next = new_bucket->tail->prev = new_node;
-            new_node->prev = new_bucket->head;
-            new_node->next = new_bucket->tail;
-            head->next->prev = new_bucket;
-            new_bucket->next = head->next;
-            new_bucket->prev = head;
-            head->next = new_bucket;
-            new_bucket->size = 1;
+        emplace_front(value);
+    }
+    void push_front(T &&value) {
+        emplace_front(std::move(value));
+    }
+
+    /**
+     * @brief   Construct an element in-place at the beginning
+     */
+    template <typename... Args>
+    void emplace_front(Args &&... args) {
+        if (head->next == tail || __saturated(head->next)) {
+            auto new_bucket = __acquire_end_bucket();
+            try {
+                new_bucket->emplace_front(std::forward<Args>(args)...);
+            } catch (...) {
+                __release_bucket(new_bucket);
+                throw;
+            }
+            __link_after(head, new_bucket);
         } else {
-            head->next->size++;
-            auto new_node = new node;
-            new_node->value = new T(value);
-            head->next->head->next->prev = new_node;
-            new_node->next = head->next->head->next;
-            new_node->prev = head->next->head;
-            head->next->head->next = new_node;
+            head->next->emplace_front(std::forward<Args>(args)...);
+            head->next->offset--;
+            __index_add(head->next, 1);
         }
+        __size++;
+        __front--;
+        __spill_tick(1);
     }
 
     /**
@@ -521,30 +3011,20 @@ class deque {
     void pop_front() {
         if (__size == 0) throw container_is_empty();
         __size--;
-        head->next->size--;
-        if (head->next->size == 0) {
-            auto tar_bucket = head->next;
-            delete tar_bucket->head->next;
-            delete tar_bucket->head;
-            delete tar_bucket->tail;
-            tar_bucket->prev->next = tar_bucket->next;
-            tar_bucket->next->prev = tar_bucket->prev;
-            delete tar_bucket;
-        } else {
-            auto tar_node = head->next->head->next;
-            tar_node->prev->next = tar_node->next;
-            tar_node->next->prev = tar_node->prev;
-            delete tar_node;
-        }
+        __front++;
+        head->next->pop_front();
+        head->next->offset++;
+        __index_add(head->next, -1);
+        if (head->next->size == 0)
+            __remove_bucket(head->next);
+        if (__spill != nullptr) __prefetch_front();
     }
 
   public:
     class iterator {
-        friend class const_iterator;
+        friend class deque;
 
-        friend iterator deque::insert(iterator, const T &);
-
-        friend iterator deque::erase(iterator);
+        friend class const_iterator;
 
       public:
         using value_type = T;
@@ -556,16 +3036,17 @@ class deque {
       private:
         deque *__deque;
         bucket *__bucket;
-        node *__node;
+        size_t __index;
 
       public:
-        explicit iterator(deque *__deque = nullptr, bucket *__bucket = nullptr, node *__node = nullptr) :
-                __deque(__deque), __bucket(__bucket), __node(__node) {}
+        explicit iterator(deque *__deque = nullptr, bucket *__bucket = nullptr, size_t __index = 0) :
+                __deque(__deque), __bucket(__bucket), __index(__index) {}
 
         iterator(const iterator &other) = default;
 
         explicit iterator(const const_iterator &other) :
-                __deque(other.__deque), __bucket(__bucket), __node(__node) {}
+                __deque(const_cast<deque *>(other.__deque)), __bucket(const_cast<bucket *>(other.__bucket)),
+                __index(other.__index) {}
 
         /**
          * @return  A new iterator pointing to the n-next element
@@ -573,26 +3054,10 @@ class deque {
          */
         iterator operator+(const difference_type &n) const {
             if (n < 0) return operator-(-n);
-            iterator new_iterator(*this);
-            difference_type cur_diff = 0;
-            while (cur_diff < n && new_iterator.__node->next != new_iterator.__bucket->tail) {
-                cur_diff++;
-                new_iterator.__node = new_iterator.__node->next;
-            }
-            if (cur_diff == n) return new_iterator;
-            cur_diff++;
-            new_iterator.__bucket = new_iterator.__bucket->next;
-            while (cur_diff + new_iterator.__bucket->size <= n && new_iterator.__bucket->size != 0) {
-                cur_diff += new_iterator.__bucket->size;
-                new_iterator.__bucket = new_iterator.__bucket->next;
-            }
-            if (new_iterator.__bucket->size == 0 && cur_diff != n) throw invalid_iterator();
-            new_iterator.__node = new_iterator.__bucket->head->next;
-            while (cur_diff < n) {
-                cur_diff++;
-                new_iterator.__node = new_iterator.__node->next;
-            }
-            return new_iterator;
+            if (__index + n < __bucket->size) return iterator(__deque, __bucket, __index + n);
+            size_t index = __index;
+            auto tar_bucket = __deque->__seek(__bucket, index, n);
+            return iterator(__deque, tar_bucket, index);
         }
 
         /**
@@ -601,26 +3066,10 @@ class deque {
          */
         iterator operator-(const difference_type &n) const {
             if (n < 0) return operator+(-n);
-            iterator new_iterator(*this);
-            difference_type cur_diff = 0;
-            while (cur_diff < n && new_iterator.__node->prev != new_iterator.__bucket->head) {
-                cur_diff++;
-                new_iterator.__node = new_iterator.__node->prev;
-            }
-            if (cur_diff == n) return new_iterator;
-            cur_diff++;
-            new_iterator.__bucket = new_iterator.__bucket->prev;
-            while (cur_diff + new_iterator.__bucket->size <= n && new_iterator.__bucket->size != 0) {
-                cur_diff += new_iterator.__bucket->size;
-                new_iterator.__bucket = new_iterator.__bucket->prev;
-            }
-            if (new_iterator.__bucket->size == 0 && cur_diff != n) throw invalid_iterator();
-            new_iterator.__node = new_iterator.__bucket->tail->prev;
-            while (cur_diff < n) {
-                cur_diff++;
-                new_iterator.__node = new_iterator.__node->prev;
-            }
-            return new_iterator;
+            if (static_cast<size_t>(n) <= __index) return iterator(__deque, __bucket, __index - n);
+            size_t index = __index;
+            auto tar_bucket = __deque->__seek(__bucket, index, -n);
+            return iterator(__deque, tar_bucket, index);
         }
 
       private:
@@ -628,12 +3077,7 @@ class deque {
          * @return  The index of this element in this deque
          */
         size_t pos() const {
-            size_t size = 0;
-            for (auto cur_node = __node; cur_node->prev != __bucket->head; cur_node = cur_node->prev)
-                size++;
-            for (auto cur_bucket = __bucket; cur_bucket->prev != __deque->head; cur_bucket = cur_bucket->prev)
-                size += cur_bucket->prev->size;
-            return size;
+            return __deque->__cached_offset(__bucket) + __index;
         }
 
       public:
@@ -652,10 +3096,7 @@ class deque {
          * @throw   invalid_iterator    if the iterator exceeds @code{end()} after moving
          */
         iterator &operator+=(const difference_type &n) {
-            iterator result = operator+(n);
-            __bucket = result.__bucket;
-            __node = result.__node;
-            return *this;
+            return *this = operator+(n);
         }
 
         /**
@@ -663,11 +3104,8 @@ class deque {
          *
          * @throw   invalid_iterator    if the iterator exceeds @code{begin()} after moving
          */
-        iterator &operator-=(const int &n) {
-            iterator result = operator-(n);
-            __bucket = result.__bucket;
-            __node = result.__node;
-            return *this;
+        iterator &operator-=(const difference_type &n) {
+            return *this = operator-(n);
         }
 
         /**
@@ -676,13 +3114,8 @@ class deque {
          * @throw   invalid_iterator    if the iterator exceeds @code{end()} after moving
          */
         const iterator operator++(int) {
-            if (*this == __deque->end()) throw invalid_iterator();
             auto backup = iterator(*this);
-            __node = __node->next;
-            if (__node == __bucket->tail) {
-                __bucket = __bucket->next;
-                __node = __bucket->head->next;
-            }
+            ++*this;
             return backup;
         }
 
@@ -692,11 +3125,10 @@ class deque {
          * @throw   invalid_iterator    if the iterator exceeds @code{end()} after moving
          */
         iterator &operator++() {
-            if (*this == __deque->end()) throw invalid_iterator();
-            __node = __node->next;
-            if (__node == __bucket->tail) {
+            if (__bucket == __deque->tail) throw invalid_iterator();
+            if (++__index == __bucket->size) {
                 __bucket = __bucket->next;
-                __node = __bucket->head->next;
+                __index = 0;
             }
             return *this;
         }
@@ -707,13 +3139,8 @@ class deque {
          * @throw   invalid_iterator    if the iterator exceeds @code{begin()} after moving
          */
         const iterator operator--(int) {
-            if (*this == __deque->begin()) throw invalid_iterator();
             auto backup = iterator(*this);
-            __node = __node->prev;
-            if (__node == __bucket->head) {
-                __bucket = __bucket->prev;
-                __node = __bucket->tail->prev;
-            }
+            --*this;
             return backup;
         }
 
@@ -723,43 +3150,47 @@ class deque {
          * @throw   invalid_iterator    if the iterator exceeds @code{begin()} after moving
          */
         iterator &operator--() {
-            if (*this == __deque->begin()) throw invalid_iterator();
-            __node = __node->prev;
-            if (__node == __bucket->head) {
+            if (__index == 0) {
+                if (__bucket->prev == __deque->head) throw invalid_iterator();
                 __bucket = __bucket->prev;
-                __node = __bucket->tail->prev;
+                __index = __bucket->size;
             }
+            __index--;
             return *this;
         }
 
         reference operator*() const {
-            if (__node == nullptr || __node->value == nullptr) throw invalid_iterator();
-            return *(__node->value);
+            if (__bucket == nullptr || __index >= __bucket->size) throw invalid_iterator();
+            __bucket->__unshare();
+            return (*__bucket)[__index];
         }
 
-        pointer operator->() const noexcept {
-            if (__node == nullptr || __node->value == nullptr) throw invalid_iterator();
-            return __node->value;
+        pointer operator->() const {
+            if (__bucket == nullptr || __index >= __bucket->size) throw invalid_iterator();
+            __bucket->__unshare();
+            return __bucket->slot(__index);
         }
 
         bool operator==(const iterator &rhs) const {
-            return __node == rhs.__node;
+            return __bucket == rhs.__bucket && __index == rhs.__index;
         }
 
         bool operator==(const const_iterator &rhs) const {
-            return __node == rhs.__node;
+            return __bucket == rhs.__bucket && __index == rhs.__index;
         }
 
         bool operator!=(const iterator &rhs) const {
-            return __node != rhs.__node;
+            return !(*this == rhs);
         }
 
         bool operator!=(const const_iterator &rhs) const {
-            return __node != rhs.__node;
+            return !(*this == rhs);
         }
     };
 
     class const_iterator {
+        friend class deque;
+
         friend class iterator;
 
       public:
@@ -772,12 +3203,12 @@ class deque {
       private:
         const deque *__deque;
         const bucket *__bucket;
-        const node *__node;
+        size_t __index;
 
       public:
         explicit const_iterator(const deque *__deque = nullptr, const bucket *__bucket = nullptr,
-                                const node *__node = nullptr) :
-                __deque(__deque), __bucket(__bucket), __node(__node) {}
+                                size_t __index = 0) :
+                __deque(__deque), __bucket(__bucket), __index(__index) {}
 
         const_iterator(const const_iterator &other) = default;
 
@@ -787,26 +3218,10 @@ class deque {
          */
         const_iterator operator+(const difference_type &n) const {
             if (n < 0) return operator-(-n);
-            const_iterator new_iterator(*this);
-            difference_type cur_diff = 0;
-            while (cur_diff < n && new_iterator.__node->next != new_iterator.__bucket->tail) {
-                cur_diff++;
-                new_iterator.__node = new_iterator.__node->next;
-            }
-            if (cur_diff == n) return new_iterator;
-            cur_diff++;
-            new_iterator.__bucket = new_iterator.__bucket->next;
-            while (cur_diff + new_iterator.__bucket->size <= n && new_iterator.__bucket->size != 0) {
-                cur_diff += new_iterator.__bucket->size;
-                new_iterator.__bucket = new_iterator.__bucket->next;
-            }
-            if (new_iterator.__bucket->size == 0 && cur_diff != n) throw invalid_iterator();
-            new_iterator.__node = new_iterator.__bucket->head->next;
-            while (cur_diff < n) {
-                cur_diff++;
-                new_iterator.__node = new_iterator.__node->next;
-            }
-            return new_iterator;
+            if (__index + n < __bucket->size) return const_iterator(__deque, __bucket, __index + n);
+            size_t index = __index;
+            auto tar_bucket = __deque->__seek(__bucket, index, n);
+            return const_iterator(__deque, tar_bucket, index);
         }
 
         /**
@@ -815,26 +3230,10 @@ class deque {
          */
         const_iterator operator-(const difference_type &n) const {
             if (n < 0) return operator+(-n);
-            const_iterator new_iterator(*this);
-            difference_type cur_diff = 0;
-            while (cur_diff < n && new_iterator.__node->prev != new_iterator.__bucket->head) {
-                cur_diff++;
-                new_iterator.__node = new_iterator.__node->prev;
-            }
-            if (cur_diff == n) return new_iterator;
-            cur_diff++;
-            new_iterator.__bucket = new_iterator.__bucket->prev;
-            while (cur_diff + new_iterator.__bucket->size <= n && new_iterator.__bucket->size != 0) {
-                cur_diff += new_iterator.__bucket->size;
-                new_iterator.__bucket = new_iterator.__bucket->prev;
-            }
-            if (new_iterator.__bucket->size == 0 && cur_diff != n) throw invalid_iterator();
-            new_iterator.__node = new_iterator.__bucket->tail->prev;
-            while (cur_diff < n) {
-                cur_diff++;
-                new_iterator.__node = new_iterator.__node->prev;
-            }
-            return new_iterator;
+            if (static_cast<size_t>(n) <= __index) return const_iterator(__deque, __bucket, __index - n);
+            size_t index = __index;
+            auto tar_bucket = __deque->__seek(__bucket, index, -n);
+            return const_iterator(__deque, tar_bucket, index);
         }
 
       private:
@@ -842,12 +3241,7 @@ class deque {
          * @return  The index of this element in this deque
          */
         size_t pos() const {
-            size_t size = 0;
-            for (auto cur_node = __node; cur_node->prev != __bucket->head; cur_node = cur_node->prev)
-                size++;
-            for (auto cur_bucket = __bucket; cur_bucket->prev != __deque->head; cur_bucket = cur_bucket->prev)
-                size += cur_bucket->prev->size;
-            return size;
+            return __deque->__cached_offset(__bucket) + __index;
         }
 
       public:
@@ -866,10 +3260,7 @@ class deque {
          * @throw   invalid_iterator    if the iterator exceeds @code{end()} after moving
          */
         const_iterator &operator+=(const difference_type &n) {
-            const_iterator result = operator+(n);
-            __bucket = result.__bucket;
-            __node = result.__node;
-            return *this;
+            return *this = operator+(n);
         }
 
         /**
@@ -877,11 +3268,8 @@ class deque {
          *
          * @throw   invalid_iterator    if the iterator exceeds @code{begin()} after moving
          */
-        const_iterator &operator-=(const int &n) {
-            const_iterator result = operator-(n);
-            __bucket = result.__bucket;
-            __node = result.__node;
-            return *this;
+        const_iterator &operator-=(const difference_type &n) {
+            return *this = operator-(n);
         }
 
         /**
@@ -890,13 +3278,8 @@ class deque {
          * @throw   invalid_iterator    if the iterator exceeds @code{end()} after moving
          */
         const const_iterator operator++(int) {
-            if (*this == __deque->cend()) throw invalid_iterator();
             auto backup = const_iterator(*this);
-            __node = __node->next;
-            if (__node == __bucket->tail) {
-                __bucket = __bucket->next;
-                __node = __bucket->head->next;
-            }
+            ++*this;
             return backup;
         }
 
@@ -906,11 +3289,10 @@ class deque {
          * @throw   invalid_iterator    if the iterator exceeds @code{end()} after moving
          */
         const_iterator &operator++() {
-            if (*this == __deque->cend()) throw invalid_iterator();
-            __node = __node->next;
-            if (__node == __bucket->tail) {
+            if (__bucket == __deque->tail) throw invalid_iterator();
+            if (++__index == __bucket->size) {
                 __bucket = __bucket->next;
-                __node = __bucket->head->next;
+                __index = 0;
             }
             return *this;
         }
@@ -921,13 +3303,8 @@ class deque {
          * @throw   invalid_iterator    if the iterator exceeds @code{begin()} after moving
          */
         const const_iterator operator--(int) {
-            if (*this == __deque->cbegin()) throw invalid_iterator();
             auto backup = const_iterator(*this);
-            __node = __node->prev;
-            if (__node == __bucket->head) {
-                __bucket = __bucket->prev;
-                __node = __bucket->tail->prev;
-            }
+            --*this;
             return backup;
         }
 
@@ -937,39 +3314,85 @@ class deque {
          * @throw   invalid_iterator    if the iterator exceeds @code{begin()} after moving
          */
         const_iterator &operator--() {
-            if (*this == __deque->cbegin()) throw invalid_iterator();
-            __node = __node->prev;
-            if (__node == __bucket->head) {
+            if (__index == 0) {
+                if (__bucket->prev == __deque->head) throw invalid_iterator();
                 __bucket = __bucket->prev;
-                __node = __bucket->tail->prev;
+                __index = __bucket->size;
             }
+            __index--;
             return *this;
         }
 
         reference operator*() const {
-            if (__node == nullptr || __node->value == nullptr) throw invalid_iterator();
-            return *(__node->value);
+            if (__bucket == nullptr || __index >= __bucket->size) throw invalid_iterator();
+            return (*__bucket)[__index];
         }
 
-        pointer operator->() const noexcept {
-            if (__node == nullptr || __node->value == nullptr) throw invalid_iterator();
-            return __node->value;
+        pointer operator->() const {
+            if (__bucket == nullptr || __index >= __bucket->size) throw invalid_iterator();
+            return __bucket->slot(__index);
         }
 
         bool operator==(const iterator &rhs) const {
-            return __node == rhs.__node;
+            return __bucket == rhs.__bucket && __index == rhs.__index;
         }
 
         bool operator==(const const_iterator &rhs) const {
-            return __node == rhs.__node;
+            return __bucket == rhs.__bucket && __index == rhs.__index;
         }
 
         bool operator!=(const iterator &rhs) const {
-            return __node != rhs.__node;
+            return !(*this == rhs);
         }
 
         bool operator!=(const const_iterator &rhs) const {
-            return __node != rhs.__node;
+            return !(*this == rhs);
+        }
+    };
+
+    /**
+     * @brief   A handle to an element, which stays valid while the element is in the container, no matter how other
+     *          elements are inserted or removed and how buckets are split or merged
+     *
+     * It is invalidated when the element is removed, or the container is cleared, sorted or destroyed. Splicing or
+     * splitting moves it along with the element to the other container. Inserting or erasing in a bucket takes time
+     * proportional to the number of handles to the elements in it.
+     */
+    class handle {
+        friend class deque;
+
+      private:
+        __anchor *__target;
+
+        explicit handle(__anchor *__target) : __target(__target) {}
+
+      public:
+        handle() : __target(nullptr) {}
+
+        handle(const handle &other) : __target(other.__target) {
+            if (__target != nullptr) __target->ref++;
+        }
+
+        handle(handle &&other) noexcept : __target(other.__target) {
+            other.__target = nullptr;
+        }
+
+        handle &operator=(handle other) {
+            std::swap(__target, other.__target);
+            return *this;
+        }
+
+        ~handle() {
+            if (__target == nullptr || --__target->ref > 0) return;
+            if (__target->owner != nullptr) __target->owner->__unlink_anchor(__target);
+            delete __target;
+        }
+
+        /**
+         * @return  Whether the element referred to is still in a container
+         */
+        bool valid() const {
+            return __target != nullptr && __target->owner != nullptr;
         }
     };
 };
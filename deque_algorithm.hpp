@@ -0,0 +1,519 @@
+#ifndef SJTU_DEQUE_ALGORITHM_HPP
+#define SJTU_DEQUE_ALGORITHM_HPP
+
+#include "deque.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace sjtu {
+
+/**
+ * @brief   Algorithms on @code{deque} working on whole buckets, which run in parallel across threads
+ */
+struct __deque_algorithm {
+    /**
+     * @return  The number of threads to run @code{count} independent tasks
+     */
+    static size_t __thread_count(size_t count) {
+        size_t threads = std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        return threads < count ? threads : count;
+    }
+
+    /**
+     * @brief   Call @code{f(i)} for each i in [0, count), splitting the range into contiguous chunks run by
+     *          different threads
+     *
+     * If @code{f} throws, the rest of that chunk is skipped, and the first exception by chunk is rethrown once all
+     * threads have been joined. A chunk whose thread cannot be started is run by the calling thread.
+     */
+    template <typename Function>
+    static void __parallel(size_t count, Function f) {
+        size_t threads = __thread_count(count);
+        if (threads <= 1) {
+            for (size_t i = 0; i < count; i++) f(i);
+            return;
+        }
+        std::unique_ptr<std::thread[]> workers(new std::thread[threads - 1]);
+        std::unique_ptr<std::exception_ptr[]> errors(new std::exception_ptr[threads]);
+        auto run = [&](size_t k) {
+            try {
+                for (size_t i = count * k / threads; i < count * (k + 1) / threads; i++) f(i);
+            } catch (...) {
+                errors[k] = std::current_exception();
+            }
+        };
+        for (size_t k = 1; k < threads; k++) {
+            try {
+                workers[k - 1] = std::thread(run, k);
+            } catch (std::system_error &) {
+                run(k);
+            }
+        }
+        run(0);
+        for (size_t k = 1; k < threads; k++)
+            if (workers[k - 1].joinable()) workers[k - 1].join();
+        for (size_t k = 0; k < threads; k++)
+            if (errors[k]) std::rethrow_exception(errors[k]);
+    }
+
+    /**
+     * @brief   The fewest elements worth a thread of their own
+     */
+    static constexpr size_t MIN_RUN = 1 << 14;
+
+    /**
+     * @return  The number of runs to split @code{count} buckets holding @code{total} elements into, one per thread
+     */
+    static size_t __run_count(size_t count, size_t total) {
+        size_t runs = __thread_count(count < total / MIN_RUN ? count : total / MIN_RUN);
+        return runs > 1 ? runs : 1;
+    }
+
+    /**
+     * @brief   Call @code{f(k, first, last)} for each k in [0, runs) in parallel, where [first, last) are the indices
+     *          of the k-th contiguous run of @code{buckets}, and the runs hold about the same number of elements
+     *
+     * @param   total   The number of elements in all buckets
+     * @param   runs    The number of runs given by @code{__run_count(count, total)}
+     */
+    template <typename Bucket, typename Function>
+    static void __parallel_runs(Bucket **buckets, size_t count, size_t total, size_t runs, Function f) {
+        if (runs == 1) {
+            f(static_cast<size_t>(0), static_cast<size_t>(0), count);
+            return;
+        }
+        // the k-th run starts from the first bucket after at least total * k / runs elements
+        std::unique_ptr<size_t[]> bounds(new size_t[runs + 1]);
+        size_t k = 0, prefix = 0;
+        for (size_t i = 0; i < count; i++) {
+            while (k < runs && prefix >= total * k / runs) bounds[k++] = i;
+            prefix += buckets[i]->size;
+        }
+        while (k <= runs) bounds[k++] = count;
+        __parallel(runs, [&](size_t i) { f(i, bounds[i], bounds[i + 1]); });
+    }
+
+    /**
+     * @return  An array of the buckets of @code{deq} in order
+     */
+    template <typename T, typename Policy, size_t InlineCapacity>
+    static std::unique_ptr<typename deque<T, Policy, InlineCapacity>::bucket *[]>
+    __buckets(const deque<T, Policy, InlineCapacity> &deq, size_t &count) {
+        count = 0;
+        for (auto cur = deq.head->next; cur != deq.tail; cur = cur->next) count++;
+        std::unique_ptr<typename deque<T, Policy, InlineCapacity>::bucket *[]> result(
+                new typename deque<T, Policy, InlineCapacity>::bucket *[count]);
+        count = 0;
+        for (auto cur = deq.head->next; cur != deq.tail; cur = cur->next) result[count++] = cur;
+        return result;
+    }
+
+    /**
+     * @brief   Make the elements of a bucket in memory, contiguous, in order and not shared, so that they form a
+     *          plain array
+     */
+    template <typename Bucket>
+    static void __linearize(Bucket *tar_bucket) {
+        tar_bucket->__unshare();
+        if (tar_bucket->reversed || tar_bucket->start + tar_bucket->size > tar_bucket->capacity)
+            tar_bucket->__reallocate(tar_bucket->capacity);
+    }
+
+    template <typename T, typename Policy, size_t InlineCapacity, typename Compare>
+    static void sort(deque<T, Policy, InlineCapacity> &deq, Compare cmp) {
+        typedef deque<T, Policy, InlineCapacity> container;
+        typedef typename container::bucket bucket;
+        size_t count;
+        auto owner = __buckets(deq, count);
+        bucket **buckets = owner.get();
+        __for_each_window(deq, buckets, count, true, [&](size_t offset, size_t limit, size_t total) {
+            // linearizing may allocate, which is not done concurrently
+            for (size_t i = offset; i < limit; i++) {
+                __linearize(buckets[i]);
+                // elements are permuted even within a single bucket, so no handle stays with its element
+                buckets[i]->__detach_anchors(0, static_cast<size_t>(-1));
+            }
+            // small containers are sorted by the calling thread only, like the other algorithms
+            size_t runs = __run_count(limit - offset, total);
+            __parallel_runs(buckets + offset, limit - offset, total, runs, [&](size_t, size_t first, size_t last) {
+                for (size_t i = offset + first; i < offset + last; i++) {
+                    T *elements = buckets[i]->data + buckets[i]->start;
+                    std::sort(elements, elements + buckets[i]->size, cmp);
+                }
+            });
+        });
+        if (count <= 1) return;
+
+        // the sorted buckets spilled above are merged from the spill file, each through its own buffer, and the
+        // buffers share the budget, so that the merge never reads a spilled bucket back as a whole
+        struct source {
+            T *cursor, *buffer;
+            size_t position, available;
+        };
+        std::unique_ptr<source[]> sources(new source[count]);
+        std::unique_ptr<size_t[]> heap(new size_t[count]);
+        size_t spilled = 0;
+        for (size_t i = 0; i < count; i++)
+            if (buckets[i]->spill != nullptr) spilled++;
+        size_t chunk = spilled > 0 ? deq.__spill_budget / sizeof(T) / spilled : 0;
+        if (spilled > 0 && chunk == 0) chunk = 1;
+        T *buffers = spilled > 0 ? static_cast<T *>(::operator new(spilled * chunk * sizeof(T))) : nullptr;
+        for (size_t i = 0, k = 0; i < count; i++) {
+            source &cur = sources[i];
+            cur.position = 0;
+            if (buckets[i]->spill != nullptr) {
+                cur.cursor = cur.buffer = buffers + chunk * k++;
+                cur.available = 0;
+            } else {
+                cur.cursor = buckets[i]->data + buckets[i]->start;
+                cur.buffer = nullptr;
+                cur.available = buckets[i]->size;
+            }
+        }
+        // the elements are trivially copyable when spilling, so they are read into the buffers directly
+        auto refill = [&](size_t i) {
+            source &cur = sources[i];
+            size_t n = buckets[i]->size - cur.position < chunk ? buckets[i]->size - cur.position : chunk;
+            FILE *file = buckets[i]->spill->file;
+            if (!container::__seek_file(file, buckets[i]->spill_offset + cur.position * sizeof(T)) ||
+                fread(cur.buffer, sizeof(T), n, file) != n)
+                throw runtime_error();
+            cur.cursor = cur.buffer;
+            cur.available = n;
+        };
+
+        // k-way merge with a binary heap of buckets ordered by their first remaining elements
+        auto before = [&](size_t a, size_t b) { return cmp(*sources[a].cursor, *sources[b].cursor); };
+        auto sift_down = [&](size_t k, size_t heap_size) {
+            while (true) {
+                size_t child = k * 2 + 1;
+                if (child >= heap_size) break;
+                if (child + 1 < heap_size && before(heap[child + 1], heap[child])) child++;
+                if (!before(heap[child], heap[k])) break;
+                std::swap(heap[k], heap[child]);
+                k = child;
+            }
+        };
+        for (size_t i = 0; i < count; i++) heap[i] = i;
+
+        size_t heap_size = count, fill = deq.__fill_size();
+        bucket *first_bucket = nullptr, *last_bucket = nullptr;
+        auto append = [&](bucket *new_bucket) {
+            if (last_bucket == nullptr) first_bucket = new_bucket;
+            else last_bucket->next = new_bucket;
+            new_bucket->prev = last_bucket;
+            new_bucket->next = nullptr;
+            last_bucket = new_bucket;
+        };
+        auto finish = [&]() {
+            ::operator delete(buffers);
+            if (first_bucket != nullptr) {
+                deq.head->next = first_bucket;
+                first_bucket->prev = deq.head;
+                last_bucket->next = deq.tail;
+                deq.tail->prev = last_bucket;
+            } else {
+                deq.head->next = deq.tail;
+                deq.tail->prev = deq.head;
+            }
+            deq.__index_dirty = true;
+            deq.__epoch++;
+        };
+        try {
+            for (size_t i = 0; i < count; i++)
+                if (sources[i].buffer != nullptr) refill(i);
+            for (size_t k = count / 2; k-- > 0;) sift_down(k, count);
+            while (heap_size > 0) {
+                if (last_bucket == nullptr || last_bucket->size == fill) {
+                    if (last_bucket != first_bucket) deq.__spill_filled(last_bucket);
+                    append(deq.__acquire_bucket(bucket::__round_up(fill)));
+                }
+                size_t i = heap[0];
+                source &cur = sources[i];
+                bucket::__relocate(last_bucket->slot(last_bucket->size), cur.cursor++);
+                last_bucket->size++;
+                cur.available--;
+                if (++cur.position == buckets[i]->size) {
+                    // a drained bucket is recycled at once, so that the merge never holds two copies of the elements
+                    buckets[i]->start = buckets[i]->size = 0;
+                    deq.__release_bucket(buckets[i]);
+                    heap[0] = heap[--heap_size];
+                } else if (cur.available == 0) {
+                    refill(i);
+                }
+                sift_down(0, heap_size);
+            }
+        } catch (...) {
+            // the merged elements are followed by the remaining ones in no particular order, where the remaining
+            // elements of a spilled bucket are read back as far as the file allows, and the rest of them are lost
+            if (last_bucket != nullptr && last_bucket->size == 0) {
+                bucket *empty = last_bucket;
+                last_bucket = empty->prev;
+                if (last_bucket == nullptr) first_bucket = nullptr;
+                else last_bucket->next = nullptr;
+                deq.__release_bucket(empty);
+            }
+            for (size_t k = 0; k < heap_size; k++) {
+                size_t i = heap[k];
+                source &cur = sources[i];
+                bucket *rest = buckets[i];
+                if (cur.buffer != nullptr) {
+                    rest = nullptr;
+                    try {
+                        rest = deq.__acquire_bucket(bucket::__round_up(buckets[i]->size - cur.position));
+                        for (; cur.available > 0; cur.available--, cur.position++)
+                            bucket::__relocate(rest->slot(rest->size++), cur.cursor++);
+                        size_t n = buckets[i]->size - cur.position;
+                        FILE *file = buckets[i]->spill->file;
+                        if (container::__seek_file(file, buckets[i]->spill_offset + cur.position * sizeof(T)) &&
+                            fread(rest->slot(rest->size), sizeof(T), n, file) == n)
+                            rest->size += n;
+                    } catch (...) {
+                    }
+                    buckets[i]->start = buckets[i]->size = 0;
+                    deq.__release_bucket(buckets[i]);
+                } else {
+                    rest->start += cur.position;
+                    rest->size -= cur.position;
+                }
+                if (rest != nullptr && rest->size > 0) append(rest);
+                else if (rest != nullptr) deq.__release_bucket(rest);
+            }
+            deq.__size = 0;
+            for (auto cur = first_bucket; cur != nullptr; cur = cur->next)
+                deq.__size += cur->size;
+            finish();
+            throw;
+        }
+        finish();
+        if (deq.__spill != nullptr) deq.__spill_cold();
+    }
+
+    /**
+     * @brief   Call @code{f(first, last, total)} on consecutive windows [first, last) of @code{buckets} holding
+     *          @code{total} elements, once the elements in the window are in memory, and not shared if
+     *          @code{unshare} is set
+     *
+     * Without spilling, all buckets form a single window. Otherwise each window fits in the spill budget, and the
+     * buckets in it which were spilled are spilled again afterwards, even if @code{f} throws, so that the container is
+     * never read into memory as a whole. Faulting and spilling are not done concurrently.
+     */
+    template <typename T, typename Policy, size_t InlineCapacity, typename Bucket, typename Function>
+    static void __for_each_window(const deque<T, Policy, InlineCapacity> &deq, Bucket **buckets, size_t count,
+                                  bool unshare, Function f) {
+        auto prepare = [&](Bucket *cur) {
+            if (unshare) cur->__unshare();
+            else if (cur->spill != nullptr) cur->__fault();
+        };
+        if (deq.__spill == nullptr) {
+            for (size_t i = 0; i < count; i++) prepare(buckets[i]);
+            f(static_cast<size_t>(0), count, deq.__size);
+            return;
+        }
+        std::unique_ptr<bool[]> cold(new bool[count]);
+        size_t first = 0, last = 0;
+        auto respill = [&]() {
+            for (size_t i = first; i < last; i++)
+                if (cold[i] && buckets[i]->spill == nullptr) buckets[i]->__try_spill_to(deq.__spill);
+        };
+        try {
+            for (; first < count; first = last) {
+                size_t bytes = 0, total = 0;
+                for (last = first; last < count; last++) {
+                    size_t bucket_bytes = deq.__bucket_bytes(buckets[last]);
+                    if (last > first && bytes + bucket_bytes > deq.__spill_budget) break;
+                    bytes += bucket_bytes;
+                    total += buckets[last]->size;
+                    cold[last] = buckets[last]->spill != nullptr;
+                    prepare(buckets[last]);
+                }
+                f(first, last, total);
+                respill();
+            }
+        } catch (...) {
+            // the window being worked on is spilled again, so that a failure does not leave it in memory
+            respill();
+            throw;
+        }
+    }
+
+    template <typename T, typename Policy, size_t InlineCapacity, typename Function>
+    static void for_each(deque<T, Policy, InlineCapacity> &deq, Function f) {
+        size_t count;
+        auto owner = __buckets(deq, count);
+        auto buckets = owner.get();
+        // unsharing may allocate, which is not done concurrently
+        __for_each_window(deq, buckets, count, true, [&](size_t offset, size_t limit, size_t total) {
+            size_t runs = __run_count(limit - offset, total);
+            __parallel_runs(buckets + offset, limit - offset, total, runs, [&](size_t, size_t first, size_t last) {
+                auto apply = [&](T *elements, size_t n) {
+                    for (size_t j = 0; j < n; j++) f(elements[j]);
+                };
+                for (size_t i = offset + first; i < offset + last; i++)
+                    buckets[i]->template __for_each_span<T *>(apply);
+            });
+        });
+    }
+
+    /**
+     * @brief   The type of the results of @code{f} on elements of type @code{T}
+     */
+    template <typename T, typename Function>
+    using __result_t = typename std::decay<decltype(std::declval<Function &>()(std::declval<const T &>()))>::type;
+
+    template <typename T, typename Policy, size_t InlineCapacity, typename Function>
+    static deque<__result_t<T, Function>, Policy> transform(const deque<T, Policy, InlineCapacity> &deq, Function f) {
+        typedef __result_t<T, Function> U;
+        typedef typename deque<U, Policy>::bucket result_bucket;
+        deque<U, Policy> result;
+        size_t count;
+        auto owner = __buckets(deq, count);
+        auto buckets = owner.get();
+        // the result has the same layout, so that each run of buckets is mapped to its own run of new buckets
+        std::unique_ptr<result_bucket *[]> targets(new result_bucket *[count]);
+        for (size_t i = 0; i < count; i++) {
+            targets[i] = result.__acquire_bucket(result_bucket::__round_up(buckets[i]->size));
+            result.__link_after(result.tail->prev, targets[i]);
+        }
+        __for_each_window(deq, buckets, count, false, [&](size_t offset, size_t limit, size_t total) {
+            size_t runs = __run_count(limit - offset, total);
+            __parallel_runs(buckets + offset, limit - offset, total, runs, [&](size_t, size_t first, size_t last) {
+                for (size_t i = offset + first; i < offset + last; i++) {
+                    // the size grows with each result, so that the results so far are destroyed with the deque if
+                    // f throws
+                    result_bucket *target = targets[i];
+                    auto apply = [&](const T *elements, size_t n) {
+                        for (size_t j = 0; j < n; j++) {
+                            new(target->data + target->start + target->size) U(f(elements[j]));
+                            target->size++;
+                        }
+                    };
+                    buckets[i]->template __for_each_span<const T *>(apply);
+                }
+            });
+        });
+        result.__size = deq.__size;
+        return result;
+    }
+
+    template <typename T, typename Policy, size_t InlineCapacity, typename Value, typename BinaryOperation>
+    static Value reduce(const deque<T, Policy, InlineCapacity> &deq, Value init, BinaryOperation op) {
+        size_t count;
+        auto owner = __buckets(deq, count);
+        auto buckets = owner.get();
+        __for_each_window(deq, buckets, count, false, [&](size_t offset, size_t limit, size_t total) {
+            // the partial result of each run, which is null if the run is empty
+            size_t runs = __run_count(limit - offset, total);
+            std::unique_ptr<std::unique_ptr<Value>[]> partials(new std::unique_ptr<Value>[runs]);
+            __parallel_runs(buckets + offset, limit - offset, total, runs, [&](size_t k, size_t first, size_t last) {
+                std::unique_ptr<Value> &partial = partials[k];
+                auto apply = [&](const T *elements, size_t n) {
+                    size_t j = 0;
+                    if (partial == nullptr && n > 0) partial.reset(new Value(elements[j++]));
+                    for (; j < n; j++) *partial = op(*partial, elements[j]);
+                };
+                for (size_t i = offset + first; i < offset + last; i++)
+                    buckets[i]->template __for_each_span<const T *>(apply);
+            });
+            // partial results are combined in order, so the operation need not be commutative
+            for (size_t k = 0; k < runs; k++)
+                if (partials[k] != nullptr) init = op(init, *partials[k]);
+        });
+        return init;
+    }
+};
+
+/**
+ * @brief   Sort the elements of a deque with @code{cmp}, which is not stable
+ *
+ * Each bucket is sorted independently in parallel across threads, and then the buckets are merged with a k-way
+ * merge into new buckets with balanced sizes, which takes O(n log n) time in total. Elements are moved rather than
+ * copied, and each old bucket is recycled as soon as it is drained, so the merge takes little memory beyond the
+ * elements themselves. All iterators are invalidated.
+ *
+ * When spilling, the buckets are sorted a window within the budget at a time and spilled again, and then merged
+ * from the spill file through buffers sharing the budget, so the container is never read into memory as a whole.
+ *
+ * If @code{cmp} throws, or the spill file cannot be read(in which case @code{runtime_error} is thrown), the
+ * elements merged so far are followed by the others in no particular order, except those which cannot be read.
+ */
+template <typename T, typename Policy, size_t InlineCapacity, typename Compare>
+void sort(deque<T, Policy, InlineCapacity> &deq, Compare cmp) {
+    __deque_algorithm::sort(deq, cmp);
+}
+
+template <typename T, typename Policy, size_t InlineCapacity>
+void sort(deque<T, Policy, InlineCapacity> &deq) {
+    __deque_algorithm::sort(deq, std::less<T>());
+}
+
+/**
+ * @brief   Call @code{f(element)} on each element of a deque in parallel, in no particular order
+ *
+ * The buckets are divided into contiguous runs holding about the same number of elements, one for each thread, and
+ * each thread walks the contiguous spans of its own buckets, so no element is located by its index. A small deque
+ * is handled by the calling thread only. @code{f} MUST be safe to call concurrently on different elements, and
+ * MUST NOT modify the deque itself. Shared buckets are copied first, so that modifying the elements never affects
+ * snapshots. When spilling, the buckets are read back and spilled again a window within the budget at a time, which
+ * also holds for @code{parallel_transform} and @code{parallel_reduce}.
+ *
+ * If @code{f} throws, the rest of the run of that thread is skipped, and the first exception by run is rethrown once
+ * all threads have been joined, which also holds for @code{parallel_transform} and @code{parallel_reduce}. The
+ * elements already visited keep their new values.
+ */
+template <typename T, typename Policy, size_t InlineCapacity, typename Function>
+void parallel_for_each(deque<T, Policy, InlineCapacity> &deq, Function f) {
+    __deque_algorithm::for_each(deq, f);
+}
+
+/**
+ * @brief   Construct a new deque of @code{f(element)} for each element of a deque in order, calling @code{f} in
+ *          parallel like @code{parallel_for_each}
+ *
+ * The new deque has the same layout of buckets, so that each thread fills its own run of buckets. @code{f} MUST be
+ * safe to call concurrently. If @code{f} throws, the results constructed so far are destroyed.
+ *
+ * @return  The deque of results, with the same bucket sizing policy
+ */
+template <typename T, typename Policy, size_t InlineCapacity, typename Function>
+deque<__deque_algorithm::__result_t<T, Function>, Policy>
+parallel_transform(const deque<T, Policy, InlineCapacity> &deq, Function f) {
+    return __deque_algorithm::transform(deq, f);
+}
+
+/**
+ * @brief   Reduce the elements of a deque with @code{op} in parallel, like @code{std::reduce}
+ *
+ * Each thread reduces its own run of buckets from the first element of the run, and the partial results are then
+ * reduced into @code{init} in order. Hence @code{op} MUST be associative, but need not be commutative. It MUST be
+ * safe to call concurrently. @code{Value} MUST be constructible from @code{T}.
+ *
+ * @return  The result, which is @code{init} if the deque is empty
+ */
+template <typename T, typename Policy, size_t InlineCapacity, typename Value, typename BinaryOperation>
+Value parallel_reduce(const deque<T, Policy, InlineCapacity> &deq, Value init, BinaryOperation op) {
+    return __deque_algorithm::reduce(deq, init, op);
+}
+
+/**
+ * @brief   Sum up the elements of a deque into @code{init} in parallel
+ */
+template <typename T, typename Policy, size_t InlineCapacity, typename Value>
+Value parallel_reduce(const deque<T, Policy, InlineCapacity> &deq, Value init) {
+    return __deque_algorithm::reduce(deq, init, std::plus<Value>());
+}
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+#include "../../deque.hpp"
+#include "../../deque_algorithm.hpp"
+#include "../class-integer.hpp"
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+/**
+ * The same workload runs on int, which is trivially copyable and moved by memcpy and memmove, and on Integer, which
+ * has a user-provided copy constructor and is moved element by element.
+ *
+ * The parallel algorithms are compared with a sequential loop over iterators on a larger deque.
+ */
+const int N = 1000000, COPIES = 20, INSERTS = 200000, SPLITS = 20000, PARALLEL_N = 20000000;
+
+class timer {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  public:
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+template <typename T>
+void run(const char *name) {
+    std::mt19937 rng(2024);
+    sjtu::deque<T> deq;
+    timer push;
+    for (int i = 0; i < N; i++)
+        deq.push_back(T(i));
+    printf("%-8s %-16s %8.3f s\n", name, "push_back", push.seconds());
+
+    timer copy;
+    for (int k = 0; k < COPIES; k++) {
+        sjtu::deque<T> other(deq);
+        if (other.size() != deq.size()) printf("WRONG\n");
+    }
+    printf("%-8s %-16s %8.3f s\n", name, "copy", copy.seconds());
+
+    timer insert;
+    for (int i = 0; i < INSERTS; i++)
+        deq.insert(deq.begin() + rng() % (deq.size() + 1), T(i));
+    for (int i = 0; i < INSERTS; i++)
+        deq.erase(deq.begin() + rng() % deq.size());
+    printf("%-8s %-16s %8.3f s\n", name, "insert + erase", insert.seconds());
+
+    timer split;
+    for (int i = 0; i < SPLITS; i++) {
+        sjtu::deque<T> rest = deq.split(deq.begin() + rng() % deq.size());
+        deq.splice(rest);
+    }
+    printf("%-8s %-16s %8.3f s\n", name, "split + splice", split.seconds());
+
+    timer compact;
+    for (int k = 0; k < COPIES; k++)
+        deq.compact();
+    printf("%-8s %-16s %8.3f s\n", name, "compact", compact.seconds());
+
+    timer clear;
+    for (int k = 0; k < COPIES; k++) {
+        sjtu::deque<T> other(deq);
+        other.clear();
+    }
+    printf("%-8s %-16s %8.3f s %s\n", name, "copy + clear", clear.seconds(), deq.size() == N ? "" : "WRONG");
+}
+
+void run_parallel() {
+    sjtu::deque<int> deq;
+    for (int i = 0; i < PARALLEL_N; i++)
+        deq.push_back(i);
+    // a few rounds of an integer hash
+    auto heavy = [](int value) {
+        unsigned x = value;
+        for (int k = 0; k < 4; k++) x = ((x >> 16) ^ x) * 0x45d9f3bu;
+        return (x >> 16) ^ x;
+    };
+
+    timer sequential;
+    unsigned long long expected = 0;
+    for (auto it = deq.cbegin(); it != deq.cend(); ++it)
+        expected += heavy(*it);
+    printf("%-8s %-16s %8.3f s\n", "int", "sequential loop", sequential.seconds());
+
+    timer transform;
+    sjtu::deque<unsigned> results = sjtu::parallel_transform(deq, heavy);
+    printf("%-8s %-16s %8.3f s\n", "int", "transform", transform.seconds());
+
+    timer reduce;
+    unsigned long long sum = sjtu::parallel_reduce(results, 0ULL);
+    printf("%-8s %-16s %8.3f s %s\n", "int", "reduce", reduce.seconds(), sum == expected ? "" : "WRONG");
+
+    timer for_each;
+    sjtu::parallel_for_each(deq, [&](int &value) { value = static_cast<int>(heavy(value)); });
+    printf("%-8s %-16s %8.3f s (%u threads)\n", "int", "for_each", for_each.seconds(),
+           std::thread::hardware_concurrency());
+}
+
+int main() {
+    run<int>("int");
+    run<Integer>("Integer");
+    run_parallel();
+}
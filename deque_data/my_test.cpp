@@ -0,0 +1,1238 @@
+#define SJTU_DEQUE_STATS
+#include "../deque.hpp"
+#include "../deque_algorithm.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef SJTU_DEQUE_MMAP
+#include <csignal>
+#include <sys/resource.h>
+#endif
+
+static int failed = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("Failed: %s (line %d)\n", #condition, __LINE__); \
+        failed++; \
+    } \
+} while (0)
+
+/**
+ * The bytes allocated by the global operator new and not yet deleted, and the peak of them since it was last reset,
+ * so that the memory held in the middle of an operation can be checked.
+ */
+static std::atomic<size_t> heap_bytes(0), heap_peak(0);
+
+void *operator new(size_t size) {
+    void *raw = malloc(size + alignof(std::max_align_t));
+    if (raw == nullptr) throw std::bad_alloc();
+    *static_cast<size_t *>(raw) = size;
+    size_t now = heap_bytes.fetch_add(size) + size, peak = heap_peak.load();
+    while (now > peak && !heap_peak.compare_exchange_weak(peak, now)) {}
+    return static_cast<char *>(raw) + alignof(std::max_align_t);
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr == nullptr) return;
+    void *raw = static_cast<char *>(ptr) - alignof(std::max_align_t);
+    heap_bytes.fetch_sub(*static_cast<size_t *>(raw));
+    free(raw);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    operator delete(ptr);
+}
+
+void test_move_only() {
+    sjtu::deque<std::unique_ptr<int>> deq;
+    for (int i = 0; i < 1000; i++) {
+        if (i % 2) deq.push_back(std::unique_ptr<int>(new int(i)));
+        else deq.emplace_front(new int(i));
+    }
+    deq.emplace(deq.begin() + 500, new int(-1));
+    deq.insert(deq.begin() + 200, std::unique_ptr<int>(new int(-2)));
+    CHECK(deq.size() == 1002);
+    CHECK(*deq[501] == -1);
+    CHECK(*deq[200] == -2);
+    sjtu::deque<std::unique_ptr<int>> moved(std::move(deq));
+    CHECK(deq.empty());
+    CHECK(moved.size() == 1002);
+    deq = std::move(moved);
+    CHECK(deq.size() == 1002 && moved.empty());
+    CHECK(*deq.front() == 998 && *deq.back() == 999);
+}
+
+void test_fifo_recycling() {
+    for (size_t limit : {size_t(0), size_t(1) << 20}) {
+        sjtu::deque<int> deq;
+        std::deque<int> ans;
+        deq.set_pool_limit(limit);
+        for (int i = 0; i < 200000; i++) {
+            deq.push_back(i);
+            ans.push_back(i);
+            if (i % 3 != 0) {
+                deq.pop_front();
+                ans.pop_front();
+            }
+        }
+        CHECK(deq.size() == ans.size());
+        for (size_t i = 0; i < ans.size(); i += 97)
+            CHECK(deq[i] == ans[i]);
+    }
+}
+
+void test_range_insert_erase() {
+    sjtu::deque<int> deq;
+    std::deque<int> ans;
+    for (int i = 0; i < 1000; i++) {
+        deq.push_back(i);
+        ans.push_back(i);
+    }
+    std::deque<int> source;
+    for (int i = 0; i < 300000; i++)
+        source.push_back(-i);
+    auto it = deq.insert(deq.begin() + 500, source.begin(), source.end());
+    ans.insert(ans.begin() + 500, source.begin(), source.end());
+    CHECK(it - deq.begin() == 500 && *it == 0);
+    it = deq.insert(deq.begin() + 123, 1000, 7);
+    ans.insert(ans.begin() + 123, 1000, 7);
+    CHECK(it - deq.begin() == 123 && *it == 7);
+    it = deq.erase(deq.begin() + 100, deq.begin() + 200100);
+    ans.erase(ans.begin() + 100, ans.begin() + 200100);
+    CHECK(it - deq.begin() == 100 && *it == ans[100]);
+    it = deq.erase(deq.begin(), deq.end());
+    CHECK(it == deq.end() && deq.empty());
+    ans.clear();
+    deq.insert(deq.end(), 10, 1);
+    ans.insert(ans.end(), 10, 1);
+    CHECK(deq.size() == ans.size());
+    for (size_t i = 0; i < ans.size(); i++)
+        CHECK(deq[i] == ans[i]);
+}
+
+void test_split_splice() {
+    const int n = 100000, workers = 7;
+    sjtu::deque<int> deq;
+    for (int i = 0; i < n; i++)
+        deq.push_back(i);
+    sjtu::deque<int> parts[workers];
+    for (int i = workers - 1; i > 0; i--)
+        parts[i] = deq.split(deq.begin() + n / workers * i);
+    parts[0] = std::move(deq);
+    for (int i = 0; i < workers; i++)
+        CHECK(parts[i].front() == n / workers * i);
+    sjtu::deque<int> result;
+    for (int i = workers - 1; i >= 0; i--)
+        result.splice(result.begin(), parts[i]);
+    result.append(result.split(result.begin() + n / 2));
+    CHECK(result.size() == n);
+    for (int i = 0; i < n; i++)
+        CHECK(result[i] == i);
+}
+
+struct Counted {
+    static int alive, copies;
+    int value;
+
+    Counted(int value) : value(value) { alive++; }
+    Counted(const Counted &other) : value(other.value) { alive++, copies++; }
+    ~Counted() { alive--; }
+};
+
+int Counted::alive = 0, Counted::copies = 0;
+
+void test_snapshot() {
+    {
+        sjtu::deque<Counted> deq;
+        for (int i = 0; i < 100000; i++)
+            deq.emplace_back(i);
+        Counted::copies = 0;
+        sjtu::deque<Counted> snapshot = deq.snapshot();
+        CHECK(Counted::copies == 0 && Counted::alive == 100000);
+        deq.pop_front();
+        deq.push_back(Counted(-1));
+        deq[50000].value = -2;
+        CHECK(Counted::copies < 10000);
+        CHECK(snapshot.size() == 100000 && snapshot.front().value == 0 && snapshot.back().value == 99999);
+        const sjtu::deque<Counted> &const_snapshot = snapshot;
+        CHECK(const_snapshot[50001].value == 50001);
+        CHECK(deq[49999].value == 50000 && deq[50000].value == -2);
+        deq = snapshot.snapshot();
+        snapshot.clear();
+        CHECK(deq.size() == 100000 && deq[50001].value == 50001);
+    }
+    CHECK(Counted::alive == 0);
+
+    // each reading thread reads its own snapshot, whose index is built lazily by const accesses
+    sjtu::deque<int> shared;
+    for (int i = 0; i < 100000; i++)
+        shared.insert(shared.begin() + shared.size() / 2, i);
+    std::vector<sjtu::deque<int>> snapshots;
+    for (int t = 0; t < 4; t++)
+        snapshots.push_back(shared.snapshot());
+    std::vector<long long> sums(4, 0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++)
+        readers.emplace_back([&, t] {
+            const sjtu::deque<int> &reading = snapshots[t];
+            for (size_t i = t; i < reading.size(); i += 7)
+                sums[t] += reading[i];
+        });
+    for (auto &reader : readers)
+        reader.join();
+    bool ok = true;
+    for (int t = 0; t < 4; t++) {
+        long long expected = 0;
+        for (size_t i = t; i < shared.size(); i += 7)
+            expected += shared[i];
+        ok = ok && sums[t] == expected;
+    }
+    CHECK(ok);
+
+    // a snapshot destroyed by another thread while the container copies the shared buckets loses no element
+    for (int round = 0; round < 20 && ok; round++) {
+        sjtu::deque<std::string> deq;
+        for (int i = 0; i < 20000; i++)
+            deq.push_back(std::to_string(i));
+        auto dropped = new sjtu::deque<std::string>(deq.snapshot());
+        std::thread dropper([&] { delete dropped; });
+        for (size_t i = 0; i < deq.size(); i += 16)
+            deq[i] += "!";
+        dropper.join();
+        size_t count = 0;
+        for (auto it = deq.begin(); it != deq.end(); ++it, ++count)
+            ok = ok && *it == std::to_string(count) + (count % 16 == 0 ? "!" : "");
+        ok = ok && count == 20000;
+    }
+    CHECK(ok);
+}
+
+void test_segments() {
+    sjtu::deque<long long> deq;
+    for (int i = 0; i < 100000; i++) {
+        if (i % 3) deq.push_back(i);
+        else deq.push_front(i);
+    }
+    deq.for_each_segment([](long long *first, size_t count) {
+        for (size_t i = 0; i < count; i++)
+            first[i] *= 2;
+    });
+    const sjtu::deque<long long> &const_deq = deq;
+    long long sum = 0, expected = 0;
+    size_t total = 0;
+    const_deq.for_each_segment([&](const long long *first, size_t count) {
+        for (size_t i = 0; i < count; i++)
+            sum += first[i];
+        total += count;
+    });
+    for (size_t i = 0; i < deq.size(); i++)
+        expected += const_deq[i];
+    CHECK(total == deq.size());
+    CHECK(sum == expected && sum == 99999LL * 100000);
+}
+
+void test_fixed_policy() {
+    sjtu::deque<int, sjtu::fixed_bucket_policy<16>> deq;
+    for (int i = 0; i < 10000; i++)
+        deq.push_back(i);
+    for (int i = 0; i < 1000; i++)
+        deq.insert(deq.begin() + i * 7, -i);
+    for (int i = 0; i < 1000; i++)
+        deq.erase(deq.begin() + i * 6);
+    bool ok = deq.size() == 10000;
+    for (int i = 0; i < 10000 && ok; i++)
+        ok = deq[i] == i;
+    CHECK(ok);
+    size_t segments = 0, max_count = 0;
+    deq.for_each_segment([&](const int *, size_t count) {
+        segments++;
+        if (count > max_count) max_count = count;
+    });
+    CHECK(max_count <= 16 && segments >= 10000 / 16);
+    while (!deq.empty())
+        deq.pop_front();
+    CHECK(deq.size() == 0);
+}
+
+void test_save_load() {
+    struct point {
+        int x;
+        double y;
+    };
+    const char *path = "deque_my_test.bin";
+    sjtu::deque<point> deq;
+    for (int i = 0; i < 50000; i++) {
+        if (i % 2) deq.push_back(point{i, i * 0.5});
+        else deq.push_front(point{i, i * 0.5});
+    }
+    deq.erase(deq.begin() + 100, deq.begin() + 300);
+    deq.save(path);
+
+    sjtu::deque<point> loaded;
+    loaded.push_back(point{-1, -1});
+    loaded.load(path);
+    bool ok = loaded.size() == deq.size();
+    for (size_t i = 0; i < deq.size() && ok; i++)
+        ok = loaded[i].x == deq[i].x && loaded[i].y == deq[i].y;
+    CHECK(ok);
+
+#ifdef SJTU_DEQUE_MMAP
+    sjtu::deque<point> mapped;
+    mapped.load_mapped(path);
+    const sjtu::deque<point> &const_mapped = mapped;
+    ok = mapped.size() == deq.size();
+    for (size_t i = 0; i < deq.size() && ok; i++)
+        ok = const_mapped[i].x == deq[i].x;
+    CHECK(ok);
+    // modifying copies the buckets out of the mapped file
+    mapped[0].x = -1;
+    mapped.pop_back();
+    mapped.insert(mapped.begin() + 1000, point{-2, 0});
+    mapped.push_front(point{-3, 0});
+    CHECK(mapped[0].x == -3 && mapped[1].x == -1 && mapped[1001].x == -2);
+    CHECK(mapped.size() == deq.size() + 1);
+    sjtu::deque<point> snap = mapped.snapshot();
+    mapped.clear();
+    CHECK(snap.size() == deq.size() + 1 && snap[2].x == deq[1].x);
+    sjtu::deque<point> reloaded;
+    reloaded.load_mapped(path);
+    CHECK(reloaded[0].x == deq[0].x && reloaded.size() == deq.size());
+#endif
+
+    sjtu::deque<long long> mismatched;
+    bool thrown = false;
+    try {
+        mismatched.load(path);
+    } catch (sjtu::runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown && mismatched.empty());
+
+    // an empty file has no header to read
+    fclose(fopen(path, "wb"));
+    thrown = false;
+    try {
+        loaded.load(path);
+    } catch (sjtu::runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown && loaded.size() == deq.size());
+
+    // a crafted header is rejected rather than trusted, where the fields following the magic are element_size,
+    // size, bucket_count and then the sizes of buckets
+    sjtu::deque<long long> values;
+    for (int i = 0; i < 1000; i++)
+        values.push_back(i);
+    auto corrupt = [&](bool mapped, unsigned long long size, unsigned long long first, unsigned long long second) {
+        values.save(path);
+        FILE *file = fopen(path, "r+b");
+        unsigned long long fields[6];
+        bool ok = fread(fields, sizeof(fields), 1, file) == 1 && fields[3] >= 2;
+        fields[2] += size;
+        fields[4] += first;
+        fields[5] += second;
+        ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(fields, sizeof(fields), 1, file) == 1;
+        fclose(file);
+        sjtu::deque<long long> victim;
+        victim.push_back(-1);
+        bool rejected = false;
+        try {
+#ifdef SJTU_DEQUE_MMAP
+            if (mapped)
+                victim.load_mapped(path);
+            else
+#endif
+                victim.load(path);
+        } catch (sjtu::runtime_error &) {
+            rejected = true;
+        }
+        return ok && rejected && victim.size() == 1 && victim[0] == -1;
+    };
+#ifdef SJTU_DEQUE_MMAP
+    const int loaders = 2;
+#else
+    const int loaders = 1;
+#endif
+    for (int mapped = 0; mapped < loaders; mapped++) {
+        // size * sizeof(T) wraps to the real length of the data
+        CHECK(corrupt(mapped, 1ull << 61, 1ull << 61, 0));
+        // the sizes of buckets add up to the size only after wrapping
+        CHECK(corrupt(mapped, 0, 1ull << 63, 1ull << 63));
+        CHECK(corrupt(mapped, 0, 1, 0));
+        // the size disagrees with the sizes of buckets
+        CHECK(corrupt(mapped, -1ull, 0, 0));
+        // the size is far beyond the file, which is rejected before allocating for it
+        CHECK(corrupt(mapped, 1ull << 40, 1ull << 40, 0));
+    }
+    values.save(path);
+    sjtu::deque<long long> intact;
+    intact.load(path);
+    CHECK(intact.size() == 1000 && intact[999] == 999);
+#ifdef SJTU_DEQUE_MMAP
+    intact.load_mapped(path);
+    CHECK(intact.size() == 1000 && intact[999] == 999);
+#endif
+    remove(path);
+}
+
+void test_stats() {
+    sjtu::deque<int> deq;
+    sjtu::deque_stats stats = deq.stats();
+    CHECK(stats.size == 0 && stats.bucket_count == 0 && stats.splits == 0 && stats.merges == 0);
+    for (int i = 0; i < 100000; i++)
+        deq.insert(deq.begin() + deq.size() / 2, i);
+    stats = deq.stats();
+    CHECK(stats.size == 100000 && stats.splits > 0 && stats.bucket_count > 1);
+    CHECK(stats.min_occupancy <= stats.avg_occupancy && stats.avg_occupancy <= stats.max_occupancy);
+    CHECK(stats.slots >= stats.size && stats.bytes >= stats.slots * sizeof(int));
+    size_t buckets = 0;
+    for (size_t i = 0; i < sjtu::deque_stats::HISTOGRAM_BINS; i++)
+        buckets += stats.histogram[i];
+    CHECK(buckets == stats.bucket_count);
+    for (int i = 0; i < 99000; i++)
+        deq.erase(deq.begin() + deq.size() / 3);
+    stats = deq.stats();
+    CHECK(stats.size == 1000 && stats.merges > 0 && stats.pool_bytes > 0);
+}
+
+void test_sort() {
+    sjtu::deque<int> deq;
+    std::deque<int> expected;
+    srand(15);
+    for (int i = 0; i < 200000; i++) {
+        int value = rand() % 100000;
+        if (i % 2) deq.push_back(value);
+        else deq.push_front(value);
+        if (i % 2) expected.push_back(value);
+        else expected.push_front(value);
+    }
+    // buckets shared with a snapshot are copied before sorting
+    sjtu::deque<int> snap = deq.snapshot();
+    std::deque<int> original = expected;
+    sjtu::sort(deq);
+    std::sort(expected.begin(), expected.end());
+    bool ok = deq.size() == expected.size();
+    for (size_t i = 0; i < expected.size() && ok; i++)
+        ok = deq[i] == expected[i];
+    CHECK(ok);
+    CHECK(*(deq.end() - 1) == expected.back() && deq.end() - deq.begin() == 200000);
+    ok = snap.size() == original.size();
+    for (size_t i = 0; i < original.size() && ok; i++)
+        ok = snap[i] == original[i];
+    CHECK(ok);
+
+    sjtu::deque<std::unique_ptr<int>> pointers;
+    for (int i = 0; i < 1000; i++)
+        pointers.emplace_back(new int(i * 7919 % 1000));
+    sjtu::sort(pointers, [](const std::unique_ptr<int> &a, const std::unique_ptr<int> &b) { return *a > *b; });
+    ok = true;
+    for (int i = 0; i < 1000; i++)
+        ok = ok && *pointers[i] == 999 - i;
+    CHECK(ok);
+    pointers.push_front(std::unique_ptr<int>(new int(1000)));
+    CHECK(*pointers.front() == 1000 && pointers.size() == 1001);
+
+    // a comparison throwing while the buckets are sorted in parallel is rethrown once every thread has been joined
+    for (size_t i = 0; i < deq.size(); i += 20000)
+        deq[i] = -1;
+    size_t before = heap_bytes.load();
+    bool thrown = false;
+    try {
+        sjtu::sort(deq, [](int a, int b) {
+            if (a < 0 || b < 0) throw 0;
+            return a < b;
+        });
+    } catch (int) {
+        thrown = true;
+    }
+    CHECK(thrown && deq.size() == 200000 && heap_bytes.load() == before);
+    sjtu::sort(deq);
+    CHECK(deq[9] == -1 && deq[10] == expected[1] && deq.back() == expected.back());
+}
+
+void test_binary_search() {
+    sjtu::deque<int> deq;
+    std::deque<int> expected;
+    CHECK(deq.lower_bound(0) == deq.end());
+    for (int i = 0; i < 30000; i++) {
+        deq.push_back(i / 3 * 2);
+        expected.push_back(i / 3 * 2);
+    }
+    deq.erase(deq.begin() + 100, deq.begin() + 200);
+    expected.erase(expected.begin() + 100, expected.begin() + 200);
+    const sjtu::deque<int> &const_deq = deq;
+    bool ok = true;
+    for (int value = -1; value <= 20001; value++) {
+        size_t lower = std::lower_bound(expected.begin(), expected.end(), value) - expected.begin();
+        size_t upper = std::upper_bound(expected.begin(), expected.end(), value) - expected.begin();
+        auto range = deq.equal_range(value);
+        ok = ok && size_t(range.first - deq.begin()) == lower && size_t(range.second - deq.begin()) == upper;
+        ok = ok && size_t(const_deq.lower_bound(value) - const_deq.cbegin()) == lower;
+    }
+    CHECK(ok);
+    CHECK(deq.upper_bound(19998) == deq.end());
+    auto greater = [](int a, int b) { return a > b; };
+    sjtu::deque<int> reversed;
+    for (int i = 1000; i > 0; i--)
+        reversed.push_back(i);
+    CHECK(*reversed.lower_bound(500, greater) == 500 && *reversed.upper_bound(500, greater) == 499);
+}
+
+void test_compact() {
+    sjtu::deque<int> deq;
+    std::deque<int> expected;
+    for (int i = 0; i < 100000; i++) {
+        deq.push_back(i);
+        expected.push_back(i);
+    }
+    // erase every other element, leaving buckets half filled
+    for (size_t i = 0; i < deq.size(); i++) {
+        deq.erase(deq.begin() + i);
+        expected.erase(expected.begin() + i);
+    }
+    size_t before = deq.stats().bucket_count;
+    deq.compact();
+    sjtu::deque_stats stats = deq.stats();
+    CHECK(stats.bucket_count < before && stats.size == expected.size());
+    deq.shrink_to_fit();
+    CHECK(deq.stats().pool_bytes == 0);
+    bool ok = deq.size() == expected.size();
+    for (size_t i = 0; i < expected.size() && ok; i++)
+        ok = deq[i] == expected[i];
+    CHECK(ok);
+
+    sjtu::deque<int> automatic;
+    automatic.set_compact_threshold(0.6);
+    for (int i = 0; i < 100000; i++)
+        automatic.push_back(i);
+    auto it = automatic.begin();
+    while (it != automatic.end()) {
+        it = automatic.erase(it);
+        if (it != automatic.end()) ++it;
+    }
+    stats = automatic.stats();
+    CHECK(stats.size == 50000 && stats.avg_occupancy >= 0.6 * sjtu::sqrt_bucket_policy::fill(50000));
+    ok = true;
+    for (int i = 0; i < 50000 && ok; i++)
+        ok = automatic[i] == i * 2 + 1;
+    CHECK(ok);
+    automatic.erase(automatic.begin() + 10, automatic.end() - 10);
+    CHECK(automatic.size() == 20 && automatic[10] == 99981);
+}
+
+void test_bulk_construct() {
+    sjtu::deque<std::string> repeated(100000, "x");
+    sjtu::deque_stats stats = repeated.stats();
+    CHECK(repeated.size() == 100000 && repeated[99999] == "x");
+    CHECK(stats.max_occupancy == sjtu::sqrt_bucket_policy::fill(100000) && stats.min_occupancy > 0);
+
+    sjtu::deque<int> defaulted(1000);
+    CHECK(defaulted.size() == 1000 && defaulted[999] == 0);
+
+    std::deque<int> source;
+    for (int i = 0; i < 50000; i++)
+        source.push_back(i * 3);
+    sjtu::deque<int> ranged(source.begin(), source.end());
+    bool ok = ranged.size() == source.size();
+    for (size_t i = 0; i < source.size() && ok; i++)
+        ok = ranged[i] == source[i];
+    CHECK(ok);
+
+    sjtu::deque<int> listed{1, 2, 3, 4, 5};
+    CHECK(listed.size() == 5 && listed[4] == 5);
+    listed = {7, 8};
+    CHECK(listed.size() == 2 && listed[0] == 7);
+
+    // single-pass iterators are appended one by one
+    std::istringstream input("10 20 30 40");
+    sjtu::deque<int> streamed{std::istream_iterator<int>(input), std::istream_iterator<int>()};
+    CHECK(streamed.size() == 4 && streamed[3] == 40);
+
+    // iterators of deque itself declare no category
+    sjtu::deque<int> copied(ranged.cbegin() + 10, ranged.cend());
+    CHECK(copied.size() == 49990 && copied[0] == 30);
+
+    ranged.assign(3, ranged[7]);
+    CHECK(ranged.size() == 3 && ranged[2] == 21);
+    ranged.assign(source.begin(), source.begin() + 100);
+    CHECK(ranged.size() == 100 && ranged[99] == 297);
+    ranged.assign({5, 6});
+    CHECK(ranged.size() == 2 && ranged[1] == 6);
+    ranged.assign(0, 1);
+    CHECK(ranged.empty());
+}
+
+void test_sequential_access() {
+    sjtu::deque<int> deq;
+    std::deque<int> expected;
+    for (int i = 0; i < 20000; i++) {
+        deq.push_back(i);
+        expected.push_back(i);
+    }
+    bool ok = true;
+    for (int round = 0; round < 20; round++) {
+        // the cursor must follow pushes, pops and structural changes between the loops
+        for (size_t i = 0; i < expected.size(); i++)
+            ok = ok && deq[i] == expected[i];
+        for (size_t i = expected.size(); i-- > 0;)
+            ok = ok && deq[i] == expected[i];
+        deq.push_front(-round);
+        expected.push_front(-round);
+        deq.insert(deq.begin() + round * 997 % deq.size(), round);
+        expected.insert(expected.begin() + round * 997 % expected.size(), round);
+        for (int i = 0; i < 300; i++) {
+            deq.pop_back();
+            expected.pop_back();
+        }
+        deq.erase(deq.begin() + round * 131 % deq.size());
+        expected.erase(expected.begin() + round * 131 % expected.size());
+    }
+    CHECK(ok);
+}
+
+void test_inline_storage() {
+    // the sentinels hold only links and sizes, and an embedded bucket smaller than a new bucket is still used
+    CHECK(sizeof(sjtu::deque<int>) < 256);
+    sjtu::deque<int, sjtu::sqrt_bucket_policy, 8> tiny;
+    for (int i = 0; i < 8; i++)
+        tiny.push_back(i);
+    CHECK(tiny.stats().bucket_count == 1 && tiny.stats().bytes == 0);
+    tiny.push_front(-1);
+    CHECK(tiny.stats().bucket_count == 2 && tiny.front() == -1 && tiny.back() == 7);
+
+    typedef sjtu::deque<std::string, sjtu::sqrt_bucket_policy, 16> small_deque;
+    small_deque deq;
+    for (int i = 0; i < 16; i++) {
+        if (i % 2) deq.push_back(std::to_string(i));
+        else deq.push_front(std::to_string(i));
+    }
+    sjtu::deque_stats st = deq.stats();
+    CHECK(st.bucket_count == 1 && st.bytes == 0);
+    deq.pop_front();
+    deq.insert(deq.begin() + 3, "x");
+    deq.erase(deq.begin() + 5);
+    CHECK(deq.stats().bytes == 0);
+
+    std::deque<std::string> expected;
+    for (size_t i = 0; i < deq.size(); i++)
+        expected.push_back(deq[i]);
+    auto same = [](const small_deque &a, const std::deque<std::string> &b) {
+        bool ok = a.size() == b.size();
+        for (size_t i = 0; ok && i < b.size(); i++)
+            ok = a[i] == b[i];
+        return ok;
+    };
+    // outgrow the embedded bucket, then shrink back into it
+    for (int i = 0; i < 500; i++) {
+        deq.push_back("b" + std::to_string(i));
+        expected.push_back("b" + std::to_string(i));
+        deq.push_front("f" + std::to_string(i));
+        expected.push_front("f" + std::to_string(i));
+    }
+    CHECK(same(deq, expected));
+    while (deq.size() > 10) {
+        deq.pop_back();
+        expected.pop_back();
+        deq.pop_front();
+        expected.pop_front();
+    }
+    CHECK(same(deq, expected));
+    deq.shrink_to_fit();
+    CHECK(same(deq, expected));
+
+    // copies, moves and swaps keep the embedded buckets in their own containers
+    small_deque copied(deq), other;
+    CHECK(same(copied, expected));
+    other.push_back("o");
+    other = std::move(copied);
+    CHECK(same(other, expected) && copied.empty());
+    for (int i = 0; i < 100; i++)
+        copied.push_back(std::to_string(i));
+    std::swap(other, copied);
+    CHECK(same(copied, expected) && other.size() == 100 && other[99] == "99");
+    copied.push_back("tail");
+    expected.push_back("tail");
+    CHECK(same(copied, expected));
+
+    auto shot = deq.snapshot();
+    deq[0] = "changed";
+    CHECK(shot.front() != "changed" && shot.size() == deq.size());
+
+    // splicing and splitting move buckets out of the container owning them
+    small_deque spliced;
+    spliced.push_back("s");
+    other.splice(other.begin() + 50, spliced);
+    CHECK(spliced.empty() && other.size() == 101 && other[50] == "s");
+    spliced.push_back("t");
+    CHECK(spliced.size() == 1 && spliced.front() == "t");
+    small_deque rest = other.split(other.begin() + 1);
+    CHECK(other.size() == 1 && other.front() == "0" && rest.size() == 100 && rest[49] == "s");
+    rest.push_front("r");
+    other.push_back("p");
+    CHECK(rest.front() == "r" && rest.back() == "99" && other.back() == "p");
+}
+
+void test_rotate_reverse() {
+    sjtu::deque<std::string> deq;
+    std::deque<std::string> expected;
+    for (int i = 0; i < 5000; i++) {
+        deq.push_back(std::to_string(i));
+        expected.push_back(std::to_string(i));
+    }
+    auto same = [&]() {
+        bool ok = deq.size() == expected.size();
+        size_t i = 0;
+        for (auto it = deq.begin(); ok && it != deq.end(); ++it, ++i)
+            ok = *it == expected[i];
+        for (i = 0; ok && i < expected.size(); i += 7)
+            ok = deq[i] == expected[i];
+        return ok;
+    };
+    deq.rotate(1234);
+    std::rotate(expected.begin(), expected.begin() + 1234, expected.end());
+    CHECK(same());
+    deq.reverse();
+    std::reverse(expected.begin(), expected.end());
+    CHECK(same());
+    CHECK(*(deq.end() - 1) == expected.back() && deq.end() - deq.begin() == 5000);
+
+    // reversed buckets keep working with every kind of modification
+    for (int round = 0; round < 50; round++) {
+        deq.push_back("b" + std::to_string(round));
+        expected.push_back("b" + std::to_string(round));
+        deq.push_front("f" + std::to_string(round));
+        expected.push_front("f" + std::to_string(round));
+        deq.pop_back();
+        expected.pop_back();
+        size_t pos = round * 977 % expected.size();
+        deq.insert(deq.begin() + pos, "i" + std::to_string(round));
+        expected.insert(expected.begin() + pos, "i" + std::to_string(round));
+        pos = round * 313 % expected.size();
+        deq.erase(deq.begin() + pos);
+        expected.erase(expected.begin() + pos);
+        if (round % 7 == 0) {
+            deq.reverse();
+            std::reverse(expected.begin(), expected.end());
+        }
+        if (round % 5 == 0) {
+            deq.rotate(round * 101 % expected.size());
+            std::rotate(expected.begin(), expected.begin() + round * 101 % expected.size(), expected.end());
+        }
+    }
+    CHECK(same());
+
+    auto shot = deq.snapshot();
+    deq.reverse();
+    deq.rotate(deq.size());
+    deq.rotate(0);
+    std::reverse(expected.begin(), expected.end());
+    CHECK(same() && shot.size() == deq.size() && shot.front() == deq.back());
+    std::string concatenated, joined;
+    deq.for_each_segment([&](const std::string *first, size_t count) {
+        for (size_t i = 0; i < count; i++) concatenated += first[i];
+    });
+    for (auto &e : expected) joined += e;
+    CHECK(concatenated == joined);
+    bool thrown = false;
+    try {
+        deq.rotate(deq.size() + 1);
+    } catch (sjtu::index_out_of_bound &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    sjtu::deque<int> numbers;
+    for (int i = 0; i < 1000; i++) numbers.push_back(i);
+    numbers.reverse();
+    sjtu::sort(numbers);
+    bool sorted = true;
+    for (int i = 0; i < 1000; i++) sorted = sorted && numbers[i] == i;
+    CHECK(sorted);
+}
+
+template <typename Deque>
+void check_handles(int seed) {
+    Deque deq;
+    std::deque<int> expected;
+    std::vector<std::pair<typename Deque::handle, int>> handles;
+    for (int i = 0; i < 3000; i++) {
+        deq.push_back(i);
+        expected.push_back(i);
+    }
+    for (int i = 0; i < 3000; i += 30)
+        handles.emplace_back(deq.handle_of(deq.begin() + i), i);
+    std::mt19937 rng(seed);
+    int next_value = 3000;
+    for (int round = 0; round < 3000; round++) {
+        size_t pos = rng() % (expected.size() + 1);
+        switch (rng() % 8) {
+            case 0:
+                deq.insert(deq.begin() + pos, next_value);
+                expected.insert(expected.begin() + pos, next_value++);
+                break;
+            case 1:
+                if (pos == expected.size()) break;
+                deq.erase(deq.begin() + pos);
+                expected.erase(expected.begin() + pos);
+                break;
+            case 2:
+                deq.push_front(next_value);
+                expected.push_front(next_value++);
+                break;
+            case 3:
+                if (expected.empty()) break;
+                deq.pop_back();
+                expected.pop_back();
+                break;
+            case 4:
+                if (pos == expected.size()) break;
+                handles.emplace_back(deq.handle_of(deq.begin() + pos), expected[pos]);
+                break;
+            case 5:
+                if (round % 10) break;
+                if (rng() % 2) {
+                    deq.reverse();
+                    std::reverse(expected.begin(), expected.end());
+                } else {
+                    deq.rotate(pos);
+                    std::rotate(expected.begin(), expected.begin() + pos, expected.end());
+                }
+                break;
+            case 6:
+                if (round % 10) break;
+                if (rng() % 2) {
+                    deq.compact();
+                } else {
+                    Deque rest = deq.split(deq.begin() + pos);
+                    deq.splice(deq.begin() + pos / 2, rest);
+                    std::rotate(expected.begin() + pos / 2, expected.begin() + pos, expected.end());
+                }
+                break;
+            default:
+                // erase through a handle, as an external index would
+                if (handles.empty()) break;
+                auto &target = handles[rng() % handles.size()];
+                if (!target.first.valid()) break;
+                auto it = deq.iterator_of(target.first);
+                expected.erase(expected.begin() + (it - deq.begin()));
+                deq.erase(it);
+                CHECK(!target.first.valid());
+        }
+    }
+    CHECK(deq.size() == expected.size());
+    bool ok = true;
+    for (auto &entry : handles) {
+        bool present = std::find(expected.begin(), expected.end(), entry.second) != expected.end();
+        ok = ok && entry.first.valid() == present;
+        if (!ok || !present) continue;
+        auto it = deq.iterator_of(entry.first);
+        ok = *it == entry.second && expected[it - deq.begin()] == entry.second;
+    }
+    CHECK(ok);
+    typename Deque::handle copied = handles.front().first;
+    deq.clear();
+    CHECK(!copied.valid() && !handles.back().first.valid());
+    bool thrown = false;
+    try {
+        deq.iterator_of(copied);
+    } catch (sjtu::invalid_iterator &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+void test_handles() {
+    check_handles<sjtu::deque<int>>(1);
+    check_handles<sjtu::deque<int, sjtu::fixed_bucket_policy<8>>>(2);
+    check_handles<sjtu::deque<int, sjtu::sqrt_bucket_policy, 16>>(3);
+
+    // handles outlive the container
+    sjtu::deque<int, sjtu::sqrt_bucket_policy, 16>::handle survivor;
+    {
+        sjtu::deque<int, sjtu::sqrt_bucket_policy, 16> small, other;
+        small.push_back(1);
+        small.push_back(2);
+        survivor = small.handle_of(small.begin() + 1);
+        std::swap(small, other);
+        CHECK(survivor.valid() && *other.iterator_of(survivor) == 2);
+    }
+    CHECK(!survivor.valid());
+
+    // sorting invalidates handles even if the elements are permuted within a single bucket
+    sjtu::deque<int> single;
+    single.push_back(5);
+    single.push_back(3);
+    single.push_back(1);
+    auto five = single.handle_of(single.begin());
+    sjtu::sort(single);
+    CHECK(!five.valid() && single[0] == 1 && single[2] == 5);
+}
+
+void test_spill() {
+    const char *path = "deque_my_test.spill";
+    {
+        sjtu::deque<long long> deq;
+        deq.enable_spill(path, 64 << 10);
+        for (long long i = 0; i < 200000; i++)
+            deq.push_back(i);
+        sjtu::deque_stats st = deq.stats();
+        CHECK(st.spills > 0 && st.spilled_buckets > 0 && st.bytes < (256 << 10));
+        CHECK(deq[123456] == 123456 && deq.stats().faults > 0);
+        long long sum = 0;
+        for (auto it = deq.cbegin(); it != deq.cend(); ++it)
+            sum += *it;
+        CHECK(sum == 200000LL * 199999 / 2);
+
+        // modifying spills the buckets faulted in by reading again
+        deq.insert(deq.begin() + 100000, -1);
+        deq.erase(deq.begin() + 50000, deq.begin() + 50010);
+        for (int i = 0; i < 1000; i++)
+            deq.push_front(-2);
+        CHECK(deq.stats().spilled_buckets > 0 && deq.stats().bytes < (256 << 10));
+        auto shot = deq.snapshot();
+        sjtu::deque<long long> rest = deq.split(deq.begin() + 150000);
+        deq.splice(deq.begin() + 1000, rest);
+
+        bool ok = true;
+        std::deque<long long> expected(1000, -2);
+        for (long long i = 0; i < 200000; i++) {
+            if (i >= 50000 && i < 50010) continue;
+            if (i == 100000) expected.push_back(-1);
+            expected.push_back(i);
+        }
+        CHECK(shot.size() == expected.size());
+        for (size_t i = 0; i < expected.size(); i += 97)
+            ok = ok && shot[i] == expected[i];
+        std::rotate(expected.begin() + 1000, expected.begin() + 150000, expected.end());
+        // the snapshot has read everything back, which is spilled again while pushing
+        for (long long i = 0; i < 10000; i++) {
+            deq.push_back(i);
+            expected.push_back(i);
+        }
+        CHECK(deq.size() == expected.size() && deq.stats().spilled_buckets > 0);
+        size_t popped = 0;
+        while (popped < 100000 && ok) {
+            ok = deq.front() == expected[popped++];
+            deq.pop_front();
+        }
+        CHECK(ok && deq.stats().prefetches > 0);
+        deq.disable_spill();
+        CHECK(deq.stats().spilled_buckets == 0);
+        for (size_t i = 0; i < deq.size(); i += 89)
+            ok = ok && deq[i] == expected[popped + i];
+        CHECK(ok);
+    }
+    {
+        // maintenance and algorithms never leave the whole container in memory
+        sjtu::deque<long long> deq;
+        deq.enable_spill(path, 16 << 10);
+        for (long long i = 0; i < 200000; i++)
+            deq.push_back(i);
+        size_t budget = deq.stats().bytes * 2;
+        deq.compact();
+        sjtu::deque_stats st = deq.stats();
+        CHECK(st.spilled_buckets > 0 && st.bytes < budget);
+        deq.set_compact_threshold(0.9);
+        deq.erase(deq.begin() + 1000, deq.begin() + 100000);
+        st = deq.stats();
+        CHECK(deq.size() == 101000 && st.spilled_buckets > 0 && st.bytes < budget);
+        sjtu::parallel_for_each(deq, [](long long &value) { value = -value; });
+        CHECK(sjtu::parallel_reduce(deq, 0LL) == -(999LL * 1000 / 2 + (100000LL + 199999) * 100000 / 2));
+        CHECK(deq.stats().bytes < budget);
+        sjtu::sort(deq);
+        st = deq.stats();
+        CHECK(st.spilled_buckets > 0 && st.bytes < budget);
+        CHECK(deq[0] == -199999 && deq[100999] == 0 && deq[100000] == -999);
+    }
+    {
+        // sorting merges the spilled buckets from the file, rather than reading them all back
+        sjtu::deque<long long> deq;
+        deq.enable_spill(path, 64 << 10);
+        std::mt19937 rng(23);
+        for (int i = 0; i < 2000000; i++)
+            deq.push_back(rng() % 1000000);
+        size_t before = heap_bytes.load();
+        heap_peak.store(before);
+        sjtu::sort(deq);
+        CHECK(heap_peak.load() - before < (1 << 20));
+        CHECK(deq.stats().spilled_buckets > 0 && deq.size() == 2000000);
+        bool ok = true;
+        long long last = -1;
+        for (auto it = deq.cbegin(); it != deq.cend(); ++it) {
+            ok = ok && last <= *it;
+            last = *it;
+        }
+        CHECK(ok);
+
+        // a comparison throwing in the middle of the merge leaves every element in the container, spilled or not
+        deq.clear();
+        long long sum = 0;
+        for (int i = 0; i < 200000; i++) {
+            deq.push_back(rng() % 1000000);
+            sum += deq.back();
+        }
+        auto shuffled = deq.snapshot();
+        shuffled.enable_spill(path, 64 << 10);
+        size_t comparisons = 0;
+        sjtu::sort(shuffled, [&](long long a, long long b) { return comparisons++, a < b; });
+        size_t countdown = comparisons - 1000;
+        bool thrown = false;
+        try {
+            sjtu::sort(deq, [&](long long a, long long b) {
+                if (--countdown == 0) throw 0;
+                return a < b;
+            });
+        } catch (int) {
+            thrown = true;
+        }
+        long long after = 0;
+        for (auto it = deq.cbegin(); it != deq.cend(); ++it)
+            after += *it;
+        CHECK(thrown && deq.size() == 200000 && after == sum);
+        sjtu::sort(deq);
+        CHECK(deq.front() <= deq[100000] && deq[100000] <= deq.back());
+    }
+    {
+        // reading every element leaves the spilled buckets spilled
+        sjtu::deque<long long> deq;
+        deq.enable_spill(path, 4 << 10);
+        for (long long i = 0; i < 200000; i++)
+            deq.push_back(i);
+        const sjtu::deque<long long> &const_deq = deq;
+        size_t budget = deq.stats().bytes * 2, spilled = deq.stats().spilled_buckets;
+        long long sum = 0;
+        const_deq.for_each_segment([&](const long long *first, size_t count) {
+            for (size_t i = 0; i < count; i++)
+                sum += first[i];
+        });
+        CHECK(sum == 200000LL * 199999 / 2 && deq.stats().bytes < budget);
+        const char *saved = "deque_my_test.spill.saved";
+        deq.save(saved);
+        CHECK(deq.stats().bytes < budget);
+        sjtu::deque<long long> copy(const_deq), loaded;
+        loaded.load(saved);
+        remove(saved);
+        sjtu::deque_stats st = deq.stats();
+        CHECK(st.bytes < budget && st.spilled_buckets == spilled);
+        CHECK(copy.size() == 200000 && copy[123456] == 123456 && loaded.size() == 200000 && loaded[99999] == 99999);
+    }
+#ifdef SJTU_DEQUE_MMAP
+    {
+        // a spill file which cannot grow keeps the buckets in memory, and never fails a push which has taken place
+        sjtu::deque<long long> deq;
+        deq.enable_spill(path, 4 << 10);
+        struct rlimit old_limit, limit;
+        getrlimit(RLIMIT_FSIZE, &old_limit);
+        limit = old_limit;
+        limit.rlim_cur = 64 << 10;
+        auto old_handler = signal(SIGXFSZ, SIG_IGN);
+        setrlimit(RLIMIT_FSIZE, &limit);
+        size_t failures = 0;
+        for (long long i = 0; i < 200000; i++) {
+            try {
+                deq.push_back(i);
+            } catch (sjtu::runtime_error &) {
+                failures++;
+            }
+        }
+        setrlimit(RLIMIT_FSIZE, &old_limit);
+        signal(SIGXFSZ, old_handler);
+        CHECK(failures == 0 && deq.size() == 200000 && deq.stats().spilled_buckets > 0);
+        CHECK(deq[0] == 0 && deq[123456] == 123456 && deq.back() == 199999);
+    }
+#endif
+    // the file is removed once no container uses it
+    FILE *file = fopen(path, "rb");
+    CHECK(file == nullptr);
+    if (file != nullptr) fclose(file);
+}
+
+/**
+ * An element remembering its own address, so that relocating it by copying its bytes is caught.
+ */
+struct SelfRef {
+    int value;
+    const SelfRef *self;
+
+    SelfRef(int value) : value(value), self(this) {}
+    SelfRef(const SelfRef &other) : value(other.value), self(this) {}
+    SelfRef &operator=(const SelfRef &other) {
+        value = other.value;
+        return *this;
+    }
+};
+
+bool same_element(int element, int value) { return element == value; }
+
+bool same_element(const SelfRef &element, int value) { return element.self == &element && element.value == value; }
+
+template <typename T>
+void check_relocation() {
+    // small buckets, so that elements keep moving between buckets
+    sjtu::deque<T, sjtu::fixed_bucket_policy<8>> deq;
+    std::deque<int> expected;
+    std::mt19937 rng(24);
+    auto same = [&](const sjtu::deque<T, sjtu::fixed_bucket_policy<8>> &actual) {
+        if (actual.size() != expected.size()) return false;
+        for (size_t i = 0; i < expected.size(); i++)
+            if (!same_element(actual[i], expected[i])) return false;
+        return true;
+    };
+    for (int i = 0; i < 3000; i++) {
+        // pushing at both ends wraps the ring arrays around
+        if (rng() % 2) deq.push_back(T(i)), expected.push_back(i);
+        else deq.push_front(T(i)), expected.push_front(i);
+        size_t pos = rng() % (expected.size() + 1);
+        deq.insert(deq.begin() + pos, T(-i));
+        expected.insert(expected.begin() + pos, -i);
+        if (i % 3 == 0) {
+            pos = rng() % expected.size();
+            deq.erase(deq.begin() + pos);
+            expected.erase(expected.begin() + pos);
+        }
+    }
+    CHECK(same(deq));
+    sjtu::deque<T, sjtu::fixed_bucket_policy<8>> copy(deq);
+    CHECK(same(copy));
+    for (int k = 0; k < 100; k++) {
+        auto rest = deq.split(deq.begin() + rng() % expected.size());
+        deq.splice(rest);
+    }
+    CHECK(same(deq));
+    deq.reverse();
+    std::reverse(expected.begin(), expected.end());
+    deq.erase(deq.begin() + 100, deq.begin() + 2000);
+    expected.erase(expected.begin() + 100, expected.begin() + 2000);
+    deq.compact();
+    CHECK(same(deq));
+}
+
+void test_trivial_relocation() {
+    check_relocation<int>();
+    check_relocation<SelfRef>();
+}
+
+/**
+ * An affine map x -> a * x + b modulo 2^64, whose composition is associative but not commutative.
+ */
+struct Affine {
+    unsigned long long a, b;
+
+    Affine(unsigned long long a, unsigned long long b) : a(a), b(b) {}
+    Affine(int value) : a(value * 2 + 1), b(value) {}
+};
+
+Affine compose(const Affine &first, const Affine &second) {
+    return Affine(first.a * second.a, first.b * second.a + second.b);
+}
+
+void test_parallel_algorithms() {
+    sjtu::deque<int> deq;
+    std::deque<int> expected;
+    for (int i = 0; i < 300000; i++) {
+        if (i % 3) deq.push_back(i), expected.push_back(i);
+        else deq.push_front(i), expected.push_front(i);
+    }
+    // reversed and shared buckets are walked in their logical order
+    deq.rotate(12345);
+    std::rotate(expected.begin(), expected.begin() + 12345, expected.end());
+    deq.reverse();
+    std::reverse(expected.begin(), expected.end());
+    sjtu::deque<int> snap = deq.snapshot();
+
+    long long sum = 0;
+    for (int value : expected) sum += value;
+    CHECK(sjtu::parallel_reduce(deq, 0LL) == sum);
+    Affine composed(1, 0);
+    for (int value : expected) composed = compose(composed, value);
+    Affine reduced = sjtu::parallel_reduce(deq, Affine(1, 0), compose);
+    CHECK(reduced.a == composed.a && reduced.b == composed.b);
+
+    sjtu::deque<std::string> strings = sjtu::parallel_transform(deq, [](int value) { return std::to_string(value); });
+    bool ok = strings.size() == expected.size();
+    for (size_t i = 0; i < expected.size() && ok; i++)
+        ok = strings[i] == std::to_string(expected[i]);
+    CHECK(ok);
+
+    sjtu::parallel_for_each(deq, [](int &value) { value = -value; });
+    ok = deq.size() == expected.size() && snap.size() == expected.size();
+    for (size_t i = 0; i < expected.size() && ok; i++)
+        ok = deq[i] == -expected[i] && snap[i] == expected[i];
+    CHECK(ok);
+
+    sjtu::deque<int> empty;
+    CHECK(sjtu::parallel_reduce(empty, 7) == 7);
+    CHECK(sjtu::parallel_transform(empty, [](int value) { return value * 2.0; }).empty());
+    sjtu::parallel_for_each(empty, [](int &value) { value = 0; });
+
+    // a throwing callable is rethrown once every thread has been joined, and leaks nothing
+    size_t before = heap_bytes.load();
+    int thrown = 0;
+    try {
+        sjtu::parallel_for_each(deq, [](int &value) {
+            if (value == -150000) throw 0;
+            value = -value;
+        });
+    } catch (int) {
+        thrown++;
+    }
+    try {
+        sjtu::parallel_transform(deq, [](int value) {
+            if (value == -150000 || value == 150000) throw 0;
+            return Counted(value);
+        });
+    } catch (int) {
+        thrown++;
+    }
+    try {
+        sjtu::parallel_reduce(strings, std::string(), [](const std::string &a, const std::string &b) {
+            if (a.size() > 100000) throw 0;
+            return a + b;
+        });
+    } catch (int) {
+        thrown++;
+    }
+    CHECK(thrown == 3 && Counted::alive == 0 && heap_bytes.load() == before);
+    sjtu::parallel_for_each(deq, [](int &value) { value = value < 0 ? -value : value; });
+    ok = deq.size() == expected.size();
+    for (size_t i = 0; i < expected.size() && ok; i++)
+        ok = deq[i] == expected[i];
+    CHECK(ok && sjtu::parallel_reduce(deq, 0LL) == sum);
+}
+
+int main() {
+    test_move_only();
+    test_fifo_recycling();
+    test_range_insert_erase();
+    test_split_splice();
+    test_snapshot();
+    test_segments();
+    test_fixed_policy();
+    test_save_load();
+    test_stats();
+    test_sort();
+    test_binary_search();
+    test_compact();
+    test_bulk_construct();
+    test_sequential_access();
+    test_inline_storage();
+    test_rotate_reverse();
+    test_handles();
+    test_spill();
+    test_trivial_relocation();
+    test_parallel_algorithms();
+    if (failed == 0) puts("All tests passed.");
+    return failed != 0;
+}
@@ -0,0 +1,189 @@
+#ifndef SJTU_WORK_STEALING_DEQUE_HPP
+#define SJTU_WORK_STEALING_DEQUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+namespace sjtu {
+
+/**
+ * @brief   A deque for work stealing, where a single owner thread pushes and pops at the back, while any other
+ *          threads steal from the front concurrently
+ *
+ * Pushing and popping by the owner take O(1) time without locks, and stealing takes O(1) time with a single CAS.
+ *
+ * This implementation is the "Chase-Lev" deque with the memory orders given by Le et al. Instead of a circular
+ * array reallocated on growing, elements are stored in buckets of fixed size, and a circular directory maps the
+ * buckets. Growing only doubles the directory and moves the pointers to the buckets, so no element is ever copied,
+ * and a thief holding an old directory still reads the same buckets. Retired directories are freed on destruction.
+ *
+ * @tparam T                The type of elements, usually a pointer or a handle to a task. MUST be trivially
+ *                          copyable, since elements are read by thieves which may lose the race.
+ * @tparam BucketCapacity   The number of elements in each bucket. MUST be a power of two.
+ */
+template <typename T, size_t BucketCapacity = 256>
+class work_stealing_deque {
+    static_assert(std::is_trivially_copyable<T>::value, "work_stealing_deque requires trivially copyable elements");
+    static_assert(BucketCapacity > 0 && (BucketCapacity & (BucketCapacity - 1)) == 0,
+                  "BucketCapacity must be a power of two");
+
+  private:
+    static constexpr size_t INITIAL_DIRECTORY = 4;
+
+    static constexpr size_t __log2(size_t n) { return n > 1 ? __log2(n >> 1) + 1 : 0; }
+    static constexpr size_t BUCKET_SHIFT = __log2(BucketCapacity);
+
+    /**
+     * @brief   A bucket of elements, whose slots are atomic since a thief may read a slot being overwritten
+     */
+    struct bucket {
+        std::atomic<T> data[BucketCapacity];
+    };
+
+    /**
+     * @brief   A circular array of buckets, where the element with index @code{i} is stored in the bucket
+     *          @code{buckets[(i / BucketCapacity) % capacity]}
+     */
+    struct directory {
+        size_t capacity;
+        bucket **buckets;
+        directory *retired;
+
+        explicit directory(size_t capacity) : capacity(capacity), buckets(new bucket *[capacity]()), retired(nullptr) {}
+        ~directory() { delete[] buckets; }
+
+        std::atomic<T> &operator[](ptrdiff_t index) const {
+            return buckets[(static_cast<size_t>(index) >> BUCKET_SHIFT) & (capacity - 1)]
+                ->data[static_cast<size_t>(index) & (BucketCapacity - 1)];
+        }
+    };
+
+    std::atomic<ptrdiff_t> __top, __bottom;
+    std::atomic<directory *> __directory;
+
+    /**
+     * @brief   Double the directory, when the bucket of @code{bottom} would share a slot with the bucket of
+     *          @code{top}, moving the live buckets into the new directory
+     *
+     * @return  The new directory
+     */
+    directory *__grow(directory *old_directory, ptrdiff_t top, ptrdiff_t bottom) {
+        auto new_directory = new directory(old_directory->capacity << 1);
+        size_t first = static_cast<size_t>(top) >> BUCKET_SHIFT, last = static_cast<size_t>(bottom) >> BUCKET_SHIFT;
+        // exactly one bucket of the old directory for each of [first, last)
+        for (size_t i = first; i < last; i++)
+            new_directory->buckets[i & (new_directory->capacity - 1)] =
+                old_directory->buckets[i & (old_directory->capacity - 1)];
+        for (size_t i = 0; i < new_directory->capacity; i++)
+            if (!new_directory->buckets[i]) new_directory->buckets[i] = new bucket;
+        new_directory->retired = old_directory;
+        __directory.store(new_directory, std::memory_order_release);
+        return new_directory;
+    }
+
+  public:
+    /**
+     * @brief   Construct an empty deque
+     */
+    work_stealing_deque() : __top(0), __bottom(0), __directory(new directory(INITIAL_DIRECTORY)) {
+        auto dir = __directory.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < dir->capacity; i++)
+            dir->buckets[i] = new bucket;
+    }
+
+    work_stealing_deque(const work_stealing_deque &) = delete;
+    work_stealing_deque &operator=(const work_stealing_deque &) = delete;
+
+    /**
+     * @brief   Destroy the deque, which MUST NOT be accessed by any other thread
+     */
+    ~work_stealing_deque() {
+        auto dir = __directory.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < dir->capacity; i++)
+            delete dir->buckets[i];
+        while (dir) {
+            auto retired = dir->retired;
+            delete dir;
+            dir = retired;
+        }
+    }
+
+    /**
+     * @brief   Push an element at the back, which MUST be called by the owner thread only
+     */
+    void push_back(const T &value) {
+        ptrdiff_t bottom = __bottom.load(std::memory_order_relaxed);
+        ptrdiff_t top = __top.load(std::memory_order_acquire);
+        directory *dir = __directory.load(std::memory_order_relaxed);
+        if ((static_cast<size_t>(bottom) >> BUCKET_SHIFT) - (static_cast<size_t>(top) >> BUCKET_SHIFT) >=
+            dir->capacity)
+            dir = __grow(dir, top, bottom);
+        (*dir)[bottom].store(value, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        __bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief   Pop the element at the back, which MUST be called by the owner thread only
+     *
+     * @return  Whether an element is popped into @code{value}, which fails only if the deque is empty
+     */
+    bool pop_back(T &value) {
+        ptrdiff_t bottom = __bottom.load(std::memory_order_relaxed) - 1;
+        directory *dir = __directory.load(std::memory_order_relaxed);
+        __bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        ptrdiff_t top = __top.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            __bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+        value = (*dir)[bottom].load(std::memory_order_relaxed);
+        if (top < bottom) return true;
+        // the last element, which may be stolen concurrently
+        bool success = __top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                                     std::memory_order_relaxed);
+        __bottom.store(bottom + 1, std::memory_order_relaxed);
+        return success;
+    }
+
+    /**
+     * @brief   Steal the element at the front, which may be called by any thread
+     *
+     * @return  Whether an element is stolen into @code{value}, which fails if the deque is empty or another thread
+     *          takes the element at the same time
+     */
+    bool steal(T &value) {
+        ptrdiff_t top = __top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        ptrdiff_t bottom = __bottom.load(std::memory_order_acquire);
+        if (top >= bottom) return false;
+        directory *dir = __directory.load(std::memory_order_acquire);
+        T result = (*dir)[top].load(std::memory_order_relaxed);
+        if (!__top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return false;
+        value = result;
+        return true;
+    }
+
+    /**
+     * @return  The number of elements, which is only a hint when other threads are accessing the deque
+     */
+    size_t size() const {
+        ptrdiff_t bottom = __bottom.load(std::memory_order_relaxed);
+        ptrdiff_t top = __top.load(std::memory_order_relaxed);
+        return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+    }
+
+    /**
+     * @return  Whether the deque is empty, which is only a hint when other threads are accessing the deque
+     */
+    bool empty() const {
+        return size() == 0;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include "../../work_stealing_deque.hpp"
+#include "../../deque.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * The owner pushes tasks and pops one after every few pushes, while the thieves steal from the front, which is the
+ * access pattern of a task queue in a thread pool.
+ */
+const int TASKS = 2000000, THIEVES = 3, POP_INTERVAL = 4;
+
+class locked_deque {
+    sjtu::deque<int> deq;
+    std::mutex mutex;
+
+  public:
+    void push_back(int value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        deq.push_back(value);
+    }
+    bool pop_back(int &value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (deq.empty()) return false;
+        value = deq.back();
+        deq.pop_back();
+        return true;
+    }
+    bool steal(int &value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (deq.empty()) return false;
+        value = deq.front();
+        deq.pop_front();
+        return true;
+    }
+    bool empty() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return deq.empty();
+    }
+};
+
+template <typename Deque>
+double run(const char *name) {
+    Deque deq;
+    std::atomic<bool> done(false);
+    std::atomic<long long> sum(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> thieves;
+    for (int k = 0; k < THIEVES; k++)
+        thieves.emplace_back([&] {
+            int value;
+            long long local = 0;
+            while (!done.load(std::memory_order_relaxed) || !deq.empty())
+                if (deq.steal(value)) local += value;
+            sum += local;
+        });
+    int value;
+    long long local = 0;
+    for (int i = 0; i < TASKS; i++) {
+        deq.push_back(i);
+        if (i % POP_INTERVAL == 0 && deq.pop_back(value)) local += value;
+    }
+    while (deq.pop_back(value))
+        local += value;
+    done = true;
+    for (auto &thief : thieves)
+        thief.join();
+    sum += local;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-24s %8.3f s %10.2f Mops/s %s\n", name, seconds, TASKS / seconds / 1e6,
+           sum.load() == (long long)TASKS * (TASKS - 1) / 2 ? "" : "WRONG");
+    return seconds;
+}
+
+int main() {
+    run<sjtu::work_stealing_deque<int>>("work_stealing_deque");
+    run<locked_deque>("mutex + sjtu::deque");
+}
@@ -0,0 +1,85 @@
+#include "../work_stealing_deque.hpp"
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static int failed = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("Failed: %s (line %d)\n", #condition, __LINE__); \
+        failed++; \
+    } \
+} while (0)
+
+void test_single_thread() {
+    sjtu::work_stealing_deque<int, 4> deq;
+    int value;
+    CHECK(!deq.pop_back(value) && !deq.steal(value));
+    for (int i = 0; i < 1000; i++)
+        deq.push_back(i);
+    CHECK(deq.size() == 1000);
+    CHECK(deq.steal(value) && value == 0);
+    CHECK(deq.pop_back(value) && value == 999);
+    // wrap around the directory many times without growing
+    bool ok = true;
+    for (int i = 0; i < 100000; i++) {
+        deq.push_back(i);
+        ok = deq.steal(value) && value == (i < 998 ? i + 1 : i - 998) && ok;
+    }
+    CHECK(ok && deq.size() == 998);
+    for (int i = 99999; !deq.empty(); i--)
+        ok = deq.pop_back(value) && value == i && ok;
+    CHECK(ok && !deq.pop_back(value));
+}
+
+void test_stress() {
+    const int N = 1000000, THIEVES = 4;
+    sjtu::work_stealing_deque<int> deq;
+    std::vector<std::atomic<int>> taken(N);
+    for (auto &t : taken) t.store(0);
+    std::atomic<bool> done(false);
+    std::atomic<long long> stolen(0);
+    std::vector<std::thread> thieves;
+    for (int k = 0; k < THIEVES; k++)
+        thieves.emplace_back([&] {
+            int value;
+            long long count = 0;
+            while (!done.load() || !deq.empty()) {
+                if (deq.steal(value)) {
+                    taken[value]++;
+                    count++;
+                }
+            }
+            stolen += count;
+        });
+    long long popped = 0;
+    int value;
+    for (int i = 0; i < N; i++) {
+        deq.push_back(i);
+        if (i % 3 == 0 && deq.pop_back(value)) {
+            taken[value]++;
+            popped++;
+        }
+    }
+    while (deq.pop_back(value)) {
+        taken[value]++;
+        popped++;
+    }
+    done = true;
+    for (auto &thief : thieves)
+        thief.join();
+    bool ok = true;
+    for (int i = 0; i < N; i++)
+        ok = ok && taken[i].load() == 1;
+    CHECK(ok);
+    CHECK(popped + stolen.load() == N);
+}
+
+int main() {
+    test_single_thread();
+    test_stress();
+    if (failed == 0) puts("All tests passed.");
+    return failed != 0;
+}